@@ -0,0 +1,261 @@
+#pragma once
+
+#include "component_id.h"
+#include "component_mask.h"
+#include "defs.h"
+#include "sparse_set.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+
+// Sorted list of the component IDs that have a column: every bit of the archetype's mask except tags.
+using ArchetypeSignature = std::vector<ComponentId>;
+
+// Where an entity's components live inside the container.
+struct EntityLocation {
+  static constexpr u32 invalid = UINT32_MAX;
+
+  u32 archetype = invalid;
+  u32 chunk     = 0;
+  u32 row       = 0;
+
+  bool valid() const { return archetype != invalid; }
+};
+
+// One slot of the entity table.
+struct EntityRecord {
+  u32            generation = 0;
+  EntityLocation location;
+};
+
+// Raw storage of one component type inside a chunk, aligned to a cache line so that vectorized loops over it can use
+// aligned loads. Only the first `size` slots hold components. Rows are kept packed, so no per-slot presence flag is
+// needed: a row has the component if it's below `size`.
+class Column {
+public:
+  static constexpr std::size_t alignment = 64;
+
+  void *data     = nullptr;
+  u32   size     = 0;
+  u32   capacity = 0;
+
+  // Change ticks of each component, see `SystemTicks`. Reserved up front like `data`.
+  std::vector<u32> added, changed;
+
+  Column() = default;
+
+  Column(const Column &other) : added(other.added), changed(other.changed), ops(other.ops) {
+    if (other.data != nullptr) {
+      ops->copy(other, *this);
+    }
+  }
+
+  Column(Column &&other) noexcept
+      : data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)),
+        capacity(std::exchange(other.capacity, 0)), added(std::move(other.added)), changed(std::move(other.changed)),
+        ops(other.ops) {}
+
+  Column &operator=(Column other) noexcept {
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(capacity, other.capacity);
+    std::swap(added, other.added);
+    std::swap(changed, other.changed);
+    std::swap(ops, other.ops);
+    return *this;
+  }
+
+  ~Column() { reset(); }
+
+  // An empty column with room for `capacity` components, which it never grows past.
+  template <typename T>
+  static Column make(u32 capacity) {
+    static constexpr Ops typeOps{
+        .allocate = [](Column &col) { col.data = ::operator new(sizeof(T) * col.capacity, alignmentOf<T>); },
+        .release =
+            [](Column &col) {
+              std::destroy_n(col.as<T>(), col.size);
+              ::operator delete(col.data, alignmentOf<T>);
+            },
+        .copy =
+            [](const Column &src, Column &dst) {
+              dst.capacity = src.capacity;
+              typeOps.allocate(dst);
+              std::uninitialized_copy_n(static_cast<const T *>(src.data), src.size, dst.as<T>());
+              dst.size = src.size;
+            },
+    };
+
+    Column column;
+    column.capacity = capacity;
+    column.ops      = &typeOps;
+    typeOps.allocate(column);
+    return column;
+  }
+
+  template <typename T>
+  T *as() {
+    return static_cast<T *>(data);
+  }
+
+  template <typename T>
+  T &back() {
+    return as<T>()[size - 1];
+  }
+
+  template <typename T, typename U>
+  void push(U &&comp) {
+    std::construct_at(as<T>() + size, std::forward<U>(comp));
+    size++;
+  }
+
+  template <typename T>
+  void append(const T *first, u32 count) {
+    std::uninitialized_copy_n(first, count, as<T>() + size);
+    size += count;
+  }
+
+  template <typename T>
+  void pop() {
+    std::destroy_at(&back<T>());
+    size--;
+  }
+
+  void pushTicks(u32 addedTick, u32 changedTick) {
+    added.push_back(addedTick);
+    changed.push_back(changedTick);
+  }
+
+  // Same as removing a component: the last ticks of `last` fill the hole.
+  void removeTicks(u32 row, Column &last) {
+    added[row]   = last.added.back();
+    changed[row] = last.changed.back();
+    last.added.pop_back();
+    last.changed.pop_back();
+  }
+
+private:
+  // What needs to know the component type.
+  struct Ops {
+    void (*allocate)(Column &);                // Allocates `data` for `capacity` components
+    void (*release)(Column &);                 // Destroys the components and frees `data`
+    void (*copy)(const Column &, Column &dst); // Fills an empty `dst` with copies of the components
+  };
+
+  template <typename T>
+  static constexpr std::align_val_t alignmentOf{std::max(alignment, alignof(T))};
+
+  const Ops *ops = nullptr;
+
+  void reset() {
+    if (data != nullptr) {
+      ops->release(*this);
+      data = nullptr;
+      size = 0;
+    }
+  }
+};
+
+// A fixed capacity block of entities that share an archetype.
+// Columns are in the same order as the archetype's signature.
+struct Chunk {
+  std::vector<Column> columns;
+  std::vector<Entity> entities;
+  u32                 capacity = 0;
+
+  u32 size() const { return static_cast<u32>(entities.size()); }
+};
+
+// All entities with the exact same set of table components.
+// Every entity in the archetype has `mask` as its component signature.
+// Chunks are kept packed: every chunk but the last is full, and there are no empty chunks.
+// The first chunk is small and each new one is twice as big as the one before, up to `chunkCapacity`, so archetypes
+// holding a handful of entities (common with tags) don't pay for a full chunk.
+struct Archetype {
+  static constexpr u32 firstChunkCapacity = 16;
+  static constexpr u32 maxChunkCapacity   = 1024;
+  static constexpr u32 chunkBytes         = 16 * 1024; // Budget of a full chunk, entity IDs and ticks included
+  static constexpr u32 noColumn           = UINT32_MAX;
+  static constexpr u32 noEdge             = UINT32_MAX;
+
+  ComponentMask      mask;
+  ArchetypeSignature signature;
+  std::vector<u32>   columnIndices; // Indexed by ComponentId
+  std::vector<Chunk> chunks;
+  u32                chunkCapacity = maxChunkCapacity; // Rows of a full sized chunk, see `setRowSize`
+
+  // Archetype graph: the archetype with one component added or removed. Indexed by ComponentId, filled lazily.
+  std::vector<u32> addEdges, removeEdges;
+
+  // `tags` are the components without a column.
+  Archetype(const ComponentMask &mask, const ComponentMask &tags) : mask(mask) {
+    mask.without(tags).forEach([this](ComponentId id) {
+      columnIndices.resize(id + 1, noColumn);
+      columnIndices[id] = signature.size();
+      signature.push_back(id);
+    });
+  }
+
+  // `bytes` is what one entity takes in the chunks' columns.
+  void setRowSize(u32 bytes) { chunkCapacity = std::clamp<u32>(chunkBytes / bytes, 1, maxChunkCapacity); }
+
+  u32 nextChunkCapacity() const {
+    return chunks.empty() ? std::min(firstChunkCapacity, chunkCapacity)
+                          : std::min(chunks.back().capacity * 2, chunkCapacity);
+  }
+
+  u32 columnIndex(ComponentId id) const { return id < columnIndices.size() ? columnIndices[id] : noColumn; }
+
+  bool has(ComponentId id) const { return mask.test(id); }
+
+  u32 addEdge(ComponentId id) const { return id < addEdges.size() ? addEdges[id] : noEdge; }
+  u32 removeEdge(ComponentId id) const { return id < removeEdges.size() ? removeEdges[id] : noEdge; }
+
+  void setAddEdge(ComponentId id, u32 archetype) { setEdge(addEdges, id, archetype); }
+  void setRemoveEdge(ComponentId id, u32 archetype) { setEdge(removeEdges, id, archetype); }
+
+  template <typename... Ts>
+  bool hasAll() const {
+    return mask.containsAll(componentMask<Ts...>());
+  }
+
+  // Tags don't have a column, all entities share the same (empty) tag instead.
+  template <typename T>
+  T *column(u32 chunk) {
+    if constexpr (isTag<T>) {
+      static std::remove_const_t<T> tags[maxChunkCapacity];
+      return tags;
+    } else {
+      return columnOf<T>(chunk).template as<T>();
+    }
+  }
+
+  template <typename T>
+  Column &columnOf(u32 chunk) {
+    return chunks[chunk].columns[columnIndices[componentId<T>()]];
+  }
+
+  u32 size() const {
+    u32 count = 0;
+    for (const auto &chunk : chunks) {
+      count += chunk.size();
+    }
+
+    return count;
+  }
+
+private:
+  static void setEdge(std::vector<u32> &edges, ComponentId id, u32 archetype) {
+    if (id >= edges.size()) {
+      edges.resize(id + 1, noEdge);
+    }
+    edges[id] = archetype;
+  }
+};
+
+} // namespace ecs
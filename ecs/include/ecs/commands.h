@@ -1,16 +1,375 @@
 #pragma once
 #include "./component_container.h"
+#include "./thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace ecs {
+
+// Append-only memory for recorded commands. Commands are placed back to back in fixed size blocks that never move,
+// so components stay where they were constructed until they're applied. `clear` keeps the blocks for the next frame.
+class CommandArena {
+public:
+  static constexpr std::size_t blockSize = 64 * 1024;
+
+  CommandArena() = default;
+
+  CommandArena(CommandArena &&)            = default;
+  CommandArena &operator=(CommandArena &&) = default;
+
+  void *allocate(std::size_t size, std::size_t align) {
+    // Too big to share a block.
+    if (size + align > blockSize) {
+      auto       &block = oversized.emplace_back(std::make_unique_for_overwrite<std::byte[]>(size + align));
+      void       *ptr   = block.get();
+      std::size_t space = size + align;
+      return std::align(align, size, ptr, space);
+    }
+
+    for (;; current++, used = 0) {
+      if (current == blocks.size()) {
+        blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(blockSize));
+      }
+
+      void       *ptr   = blocks[current].get() + used;
+      std::size_t space = blockSize - used;
+
+      if (std::align(align, size, ptr, space) != nullptr) {
+        used = blockSize - space + size;
+        return ptr;
+      }
+    }
+  }
+
+  void clear() {
+    current = 0;
+    used    = 0;
+    oversized.clear();
+  }
+
+private:
+  std::vector<std::unique_ptr<std::byte[]>> blocks, oversized;
+  std::size_t                               current = 0; // Block being filled
+  std::size_t                               used    = 0; // Bytes used in the current block
+};
+
+// The commands recorded by one thread, see `Commands`.
+// Each command is a small header followed by its components in a `CommandArena`.
+class CommandBuffer {
+public:
+  CommandBuffer() = default;
+
+  CommandBuffer(CommandBuffer &&)            = default;
+  CommandBuffer &operator=(CommandBuffer &&) = delete;
+
+  ~CommandBuffer() { clear(); }
+
+  template <typename... Ts>
+  void addEntity(Entity eid, Ts &&...comps) {
+    using Components = std::tuple<std::decay_t<Ts>...>;
+
+    auto *payload = new (arena.allocate(sizeof(Components), alignof(Components)))
+        Components(std::forward<Ts>(comps)...);
+    spawns.push_back(Command{
+        .type    = &spawnType<std::decay_t<Ts>...>(),
+        .entity  = eid,
+        .payload = payload,
+        .order   = ThreadPool::orderKey(),
+    });
+  }
+
+  void removeEntity(Entity e) { despawns.push_back(Despawn{.entity = e, .order = ThreadPool::orderKey()}); }
+
+  template <typename T>
+  void insert(Entity e, T &&comp) {
+    using Comp = std::decay_t<T>;
+
+    auto *payload = new (arena.allocate(sizeof(Comp), alignof(Comp))) Comp(std::forward<T>(comp));
+    changes.push_back(
+        Command{.type = &insertType<Comp>(), .entity = e, .payload = payload, .order = ThreadPool::orderKey()}
+    );
+  }
+
+  template <typename T>
+  void remove(Entity e) {
+    changes.push_back(Command{
+        .type    = &removeType<std::decay_t<T>>(),
+        .entity  = e,
+        .payload = nullptr,
+        .order   = ThreadPool::orderKey(),
+    });
+  }
+
+  // Drops the recorded commands without applying them.
+  void clear() {
+    for (const auto &command : spawns) {
+      command.type->destroy(command.payload);
+    }
+    for (const auto &command : changes) {
+      command.type->destroy(command.payload);
+    }
+
+    spawns.clear();
+    changes.clear();
+    despawns.clear();
+    arena.clear();
+  }
+
+private:
+  friend struct Commands;
+
+  // How to apply one kind of command to its payload. One static table per command and component types.
+  struct CommandType {
+    // Gives each entity the components of its payload.
+    void (*spawn)(ComponentContainer &cc, std::span<const Entity> eids, std::span<void *const> payloads);
+    // Same for one entity that was added before the command was applied, see `Commands::apply`.
+    void (*place)(ComponentContainer &cc, Entity eid, void *payload);
+    void (*change)(ComponentContainer &cc, Entity eid, void *payload);
+    void (*destroy)(void *payload);
+  };
+
+  struct Command {
+    const CommandType *type;
+    Entity             entity; // Reserved ID for spawns, invalid if it gets one when applied
+    void              *payload;
+    u32                order; // `ThreadPool::orderKey` when recorded
+  };
+
+  struct Despawn {
+    Entity entity;
+    u32    order;
+  };
+
+  template <typename... Ts>
+  static const CommandType &spawnType() {
+    using Components = std::tuple<Ts...>;
+
+    static constexpr CommandType type{
+        .spawn =
+            [](ComponentContainer &cc, std::span<const Entity> eids, std::span<void *const> payloads) {
+              cc.placeBatch<Ts...>(eids, [&](Archetype &archetype, Chunk &chunk, u32 first, auto run) {
+                auto pushColumn = [&]<std::size_t I>() {
+                  using T      = std::tuple_element_t<I, Components>;
+                  auto *column = cc.tableColumn<T>(archetype, chunk);
+
+                  for (u32 i = 0; i < run.size(); i++) {
+                    auto &comps = *static_cast<Components *>(payloads[first + i]);
+                    cc.pushComponent(column, run[i], std::move(std::get<I>(comps)));
+                  }
+                };
+
+                [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+                  (pushColumn.template operator()<Is>(), ...);
+                }(std::index_sequence_for<Ts...>{});
+              });
+            },
+        .place =
+            [](ComponentContainer &cc, Entity eid, void *payload) {
+              std::apply(
+                  [&](Ts &...comps) {
+                    (cc.insert(eid, std::move(comps)), ...);
+                  },
+                  *static_cast<Components *>(payload)
+              );
+            },
+        .change  = nullptr,
+        .destroy = [](void *payload) { std::destroy_at(static_cast<Components *>(payload)); },
+    };
+
+    return type;
+  }
+
+  template <typename T>
+  static const CommandType &insertType() {
+    static constexpr CommandType type{
+        .spawn = nullptr,
+        .place = nullptr,
+        .change =
+            [](ComponentContainer &cc, Entity eid, void *payload) {
+              cc.insert(eid, std::move(*static_cast<T *>(payload)));
+            },
+        .destroy = [](void *payload) { std::destroy_at(static_cast<T *>(payload)); },
+    };
+
+    return type;
+  }
+
+  template <typename T>
+  static const CommandType &removeType() {
+    static constexpr CommandType type{
+        .spawn   = nullptr,
+        .place   = nullptr,
+        .change  = [](ComponentContainer &cc, Entity eid, void * /*payload*/) { cc.remove<T>(eid); },
+        .destroy = [](void * /*payload*/) {},
+    };
+
+    return type;
+  }
+
+  CommandArena         arena;
+  std::vector<Command> spawns, changes;
+  std::vector<Despawn> despawns;
+};
+
+// Structural changes recorded by systems, applied by the level once all of its systems ran.
+// Each thread of the global pool records into its own `CommandBuffer`, so systems running in parallel don't contend.
+// New entities get their ID right away, reserved from the level's container with an atomic counter, so later commands
+// can refer to them before anything is applied.
+// When applied, the buffers are merged in the order of the systems that recorded the commands (see
+// `ThreadPool::orderKey`), whichever threads ran them, and each system's commands keep the order they were recorded in.
+// Only the commands a system records from several threads at once, in a parallel loop, are merged in thread order.
+// New entities are grouped by component set and each group is added as one batch, a column at a time. Component
+// inserts and removes follow, then entity removals. Applying empties the buffers but keeps their memory.
 struct Commands {
-  ComponentContainer  entitiesToAdd;
-  std::vector<Entity> entitiesToRemove;
+  Commands() : buffers(ThreadPool::global().threadCount()) {}
+
+  Commands(Commands &&)            = default;
+  Commands &operator=(Commands &&) = delete;
+
+  // Done by the level this is a resource of. Entities spawned before get their ID when applied, and `addEntity`
+  // returns an invalid entity for them.
+  void reserveFrom(ComponentContainer &cc) { container = &cc; }
 
   template <typename... Ts>
-  void addEntity(Ts &&...comps) {
-    entitiesToAdd.addEntity(std::forward<Ts>(comps)...);
+  Entity addEntity(Ts &&...comps) {
+    const auto eid = container != nullptr ? container->reserveEntity() : Entity{};
+    local().addEntity(eid, std::forward<Ts>(comps)...);
+    return eid;
+  }
+
+  void removeEntity(Entity e) { local().removeEntity(e); }
+
+  template <typename T>
+  void insert(Entity e, T &&comp) {
+    local().insert(e, std::forward<T>(comp));
+  }
+
+  template <typename T>
+  void remove(Entity e) {
+    local().template remove<T>(e);
+  }
+
+  void apply(ComponentContainer &cc) {
+    for (auto &group : spawnGroups) {
+      group.entities.clear();
+      group.payloads.clear();
+    }
+
+    gather(&CommandBuffer::spawns, orderedSpawns);
+    gather(&CommandBuffer::changes, orderedChanges);
+    gather(&CommandBuffer::despawns, orderedDespawns);
+
+    for (auto *spawn : orderedSpawns) {
+      if (spawn->entity == Entity{}) {
+        spawn->entity = cc.reserveEntity();
+      }
+    }
+    const auto reserved = cc.allocateReservedEntities();
+
+    for (const auto *spawn : orderedSpawns) {
+      // Removed before being applied.
+      if (!cc.isAlive(spawn->entity)) {
+        continue;
+      }
+
+      // Added without components before being applied, when the container flushed its reserved entities. It moves to
+      // its archetype like it would with `insert`, keeping what it got meanwhile.
+      if (cc.entityRecords[spawn->entity.index].location.valid()) {
+        spawn->type->place(cc, spawn->entity, spawn->payload);
+        continue;
+      }
+
+      auto group = std::find_if(spawnGroups.begin(), spawnGroups.end(), [&](const SpawnGroup &g) {
+        return g.type == spawn->type;
+      });
+
+      if (group == spawnGroups.end()) {
+        group = spawnGroups.insert(spawnGroups.end(), SpawnGroup{.type = spawn->type, .entities = {}, .payloads = {}});
+      }
+      group->entities.push_back(spawn->entity);
+      group->payloads.push_back(spawn->payload);
+    }
+
+    for (const auto &group : spawnGroups) {
+      if (!group.entities.empty()) {
+        group.type->spawn(cc, group.entities, group.payloads);
+      }
+    }
+
+    // Entities reserved from the container by someone else.
+    cc.placeWithoutComponents(reserved);
+
+    for (const auto *change : orderedChanges) {
+      change->type->change(cc, change->entity, change->payload);
+    }
+
+    for (const auto *despawn : orderedDespawns) {
+      cc.removeEntity(despawn->entity);
+    }
+
+    drop();
+  }
+
+  // Drops the recorded commands without applying them. The entities reserved for the dropped spawns are removed, so
+  // that their IDs are free to be reused.
+  void clear() {
+    if (container != nullptr) {
+      container->flushReservedEntities();
+
+      for (const auto &buffer : buffers) {
+        for (const auto &spawn : buffer.spawns) {
+          if (spawn.entity != Entity{} && container->isAlive(spawn.entity)) {
+            container->removeEntity(spawn.entity);
+          }
+        }
+      }
+    }
+
+    drop();
+  }
+
+private:
+  // Spawns of the same component set, kept between frames so their vectors keep their capacity.
+  struct SpawnGroup {
+    const CommandBuffer::CommandType *type;
+    std::vector<Entity>               entities;
+    std::vector<void *>               payloads;
+  };
+
+  CommandBuffer &local() { return buffers[ThreadPool::global().threadIndex()]; }
+
+  void drop() {
+    for (auto &buffer : buffers) {
+      buffer.clear();
+    }
   }
 
-  void removeEntity(Entity e) { entitiesToRemove.push_back(e); }
+  // Fills `ordered` with the commands in `list` of every buffer, sorted by `order`. The sort is stable and the
+  // buffers are visited in thread order, so commands with the same order stay in thread order, then recording order.
+  template <typename C>
+  void gather(std::vector<C> CommandBuffer::*list, std::vector<C *> &ordered) {
+    ordered.clear();
+    for (auto &buffer : buffers) {
+      for (auto &command : buffer.*list) {
+        ordered.push_back(&command);
+      }
+    }
+
+    std::ranges::stable_sort(ordered, {}, [](const C *command) { return command->order; });
+  }
+
+  std::vector<CommandBuffer> buffers; // Indexed by `ThreadPool::threadIndex`
+  std::vector<SpawnGroup>    spawnGroups;
+  ComponentContainer        *container = nullptr;
+
+  // Scratch space of `apply`, kept for its capacity.
+  std::vector<CommandBuffer::Command *> orderedSpawns, orderedChanges;
+  std::vector<CommandBuffer::Despawn *> orderedDespawns;
 };
 } // namespace ecs
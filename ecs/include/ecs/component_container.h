@@ -1,145 +1,761 @@
 #pragma once
 
+#include "archetype.h"
+#include "component_id.h"
+#include "component_mask.h"
 #include "defs.h"
+#include "query_terms.h"
+#include "sparse_set.h"
+#include "ticks.h"
 
 #include <any>
-#include <functional>
+#include <atomic>
+#include <bit>
 #include <iostream>
 #include <optional>
-#include <typeindex>
+#include <span>
+#include <tuple>
+#include <unordered_map>
 
 namespace ecs {
 
-// Dense component storage.
-// Each extra component adds an extra vector with space for all existing entities.
+// The archetypes matching a query, kept by the system running it so they don't have to be looked for on every run.
+// Archetypes are never removed, so the list only needs to be extended with the ones created since it was last
+// updated, see `ComponentContainer::updateMatches`.
+struct ArchetypeMatches {
+  std::vector<u32> archetypes;     // Indices of the matching archetypes
+  u32              checked    = 0; // Number of the container's archetypes looked at so far
+  u32              generation = 0; // See `ComponentContainer::generation`
+};
+
+// Archetype storage.
+// Entities with the same set of components are grouped together into chunks of densely packed columns,
+// so queries only ever touch the chunks of archetypes that match.
+// Components whose `ComponentStorage` is `SparseSet` live in one sparse set per type instead, and are not part of
+// the archetype: adding or removing them doesn't move the entity, and rare ones don't split archetypes.
 struct ComponentContainer {
 
   // Hold compile time information about the type of the component.
+  // One static table of plain function pointers per type (see `operationsOf`), shared by all containers.
   struct ComponentOperation {
-    std::function<void()>                                     pushDummy;
-    std::function<void(ComponentContainer &, Entity, Entity)> moveComponent;
-    std::function<void(Entity)>                               removeComponent;
+    StorageType storage;
+    bool        tag; // See `isTag`, tags have no column
+
+    // Table storage only.
+    u32 size; // Of the component, to size chunks
+
+    // Creates an empty column with space for `capacity` components.
+    Column (*makeColumn)(u32 capacity);
+
+    // Moves the component at `srcRow` of `src` to the end of `dst`.
+    void (*moveComponent)(Column &src, u32 srcRow, Column &dst);
+
+    // Replaces the component at `row` of `column` with the last component of `last`, then shrinks `last`.
+    void (*removeComponent)(Column &column, u32 row, Column &last);
+
+    // Sparse set storage only, sets are `SparseSet<T>`.
+    std::any (*makeSparseSet)();
+
+    // Removes the component of `index`, if it has one.
+    void (*removeFromSet)(std::any &set, u32 index);
   };
 
   friend class ECS;
   friend struct Commands;
+  friend class CommandBuffer;
 
-  // Contain the data for all entities
-  std::unordered_map<std::type_index, std::any> componentVectors;
+  std::vector<Archetype>                                        archetypes;
+  std::unordered_map<ComponentMask, u32, ComponentMask::Hasher> archetypeIndices;
+  std::vector<EntityRecord>                                     entityRecords; // Indexed by Entity::index
+  std::vector<u32>                                              freeIndices;   // Slots of removed entities
 
-  // Need something to map a type id to a std::vector<T>::push_back
-  std::unordered_map<std::type_index, ComponentOperation> componentOperations;
+  // For each ComponentId, a bitset over archetype indices with a bit set for each archetype containing that
+  // component. Lets queries find their archetypes 64 at a time.
+  std::vector<std::vector<u64>> archetypesWith;
 
-  uint32_t numEntities = 0;
+  // Operations on the columns of each component type this container has seen, null for the others.
+  // Indexed by ComponentId.
+  std::vector<const ComponentOperation *> componentOperations;
 
-  // Given a type, get an optional (might not exist) reference to its component vector.
-  template <typename T>
-  std::optional<std::reference_wrapper<Vector<T>>> getComponentVector() {
-    if (!componentVectors.contains(typeid(T))) {
-      return {};
+  std::vector<std::any> sparseSets;       // Indexed by ComponentId
+  ComponentMask         sparseComponents; // Components stored in `sparseSets`
+  ComponentMask         tagComponents;    // Table components without a column
+
+  // Stamped on components added or changed outside of systems. Starts past 0 so that it's newer than the
+  // `lastRun` of systems that haven't run yet.
+  u32 changeTick = 1;
+
+  // Bumped by `clear`, which throws away every archetype and with them what `ArchetypeMatches` refer to.
+  u32 generation = 0;
+
+  // Bumped whenever a row is added to or removed from an archetype, so that queries can tell when the views they keep
+  // are still up to date (see `MultiIterator::Cache`).
+  u32 rowsVersion = 0;
+
+  // Entities handed out by `reserveEntity` that aren't added yet.
+  struct ReservedCount {
+    std::atomic<u32> value = 0;
+
+    ReservedCount() = default;
+    ReservedCount(const ReservedCount &other) : value(other.value.load(std::memory_order_relaxed)) {}
+    ReservedCount &operator=(const ReservedCount &other) {
+      value = other.value.load(std::memory_order_relaxed);
+      return *this;
     }
+  } reserved;
+
+  template <typename... Ts>
+  Entity addEntity(Ts &&...comps) {
+    flushReservedEntities();
+    (lazilyRegisterComponentOperations<std::decay_t<Ts>>(), ...);
+
+    const auto archetypeId = getOrCreateArchetype(tableMask<std::decay_t<Ts>...>());
+    const auto eid         = allocateEntity();
+    auto      &chunk       = allocateRow(archetypeId, eid);
 
-    // NOTE: map::operator[] default constructs at whatever key you're looking
-    // up if there's no value there. In this case, it constructs an empty
-    // `std::any`
-    return std::any_cast<Vector<T> &>(componentVectors.at(typeid(T)));
+    (addComponent(archetypes[archetypeId], chunk, eid, std::forward<Ts>(comps)), ...);
+
+    return eid;
+  }
+
+  // Adds `count` entities, the i-th one getting the components in the `std::tuple` returned by `generator(i)`.
+  // Lookups and allocations are done once for the whole batch, then components are written a chunk at a time.
+  template <typename F>
+  std::vector<Entity> addEntities(u32 count, F &&generator) {
+    using Components = std::invoke_result_t<F &, u32>;
+
+    return [&]<typename... Ts>(std::type_identity<std::tuple<Ts...>>) {
+      return addBatch<std::decay_t<Ts>...>(count, [&](Archetype &archetype, Chunk &chunk, u32 first, auto run) {
+        auto columns = std::make_tuple(tableColumn<std::decay_t<Ts>>(archetype, chunk)...);
+
+        for (u32 i = 0; i < run.size(); i++) {
+          auto comps = generator(first + i);
+          [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+            (pushComponent(std::get<Is>(columns), run[i], std::move(std::get<Is>(comps))), ...);
+          }(std::index_sequence_for<Ts...>{});
+        }
+      });
+    }(std::type_identity<std::remove_cvref_t<Components>>{});
   }
 
+  // Adds one entity per element, the i-th one getting the i-th element of each span. All spans must be the same size.
+  // Each column is filled with a single copy per chunk.
   template <typename... Ts>
-  Entity addEntity(Ts &&...comps) {
-    (lazilyInitComponentVector<Ts>(), ...);
-    (lazilyRegisterComponentOperations<Ts>(), ...);
+  requires(sizeof...(Ts) > 0)
+  std::vector<Entity> addEntities(std::span<const Ts>... comps) {
+    const auto count = static_cast<u32>(std::get<0>(std::tie(comps...)).size());
 
-    for (auto &[type_id, op] : componentOperations) {
-      op.pushDummy();
+    if (((comps.size() != count) || ...)) {
+      std::cerr << "Attempt to bulk add entities from component spans of different sizes.\n";
+      return {};
     }
 
-    (addComponent(std::forward<Ts>(comps)), ...);
+    return addBatch<Ts...>(count, [&](Archetype &archetype, Chunk &chunk, u32 first, auto run) {
+      auto copyColumn = [&]<typename T>(std::span<const T> src) {
+        if constexpr (isSparse<T>) {
+          for (u32 i = 0; i < run.size(); i++) {
+            sparseSet<T>().insert(run[i], src[first + i], changeTick);
+          }
+        } else if constexpr (!isTag<T>) {
+          tableColumn<T>(archetype, chunk)->append(src.data() + first, run.size());
+        }
+      };
 
-    return numEntities++;
+      (copyColumn(comps), ...);
+    });
   }
 
-  // Optional over the OptIters since the component vector might not exist.
-  template <typename... Ts>
-  using EntityQueryResult = std::tuple<std::optional<OptIter<Ts>>...>;
+  bool isAlive(Entity eid) const {
+    return eid.index < entityRecords.size() && entityRecords[eid.index].generation == eid.generation;
+  }
+
+  u32 aliveCount() const { return entityRecords.size() - freeIndices.size(); }
+
+  // Hands out the ID the next added entity will get, without adding it, so that it can be referred to right away.
+  // Lock free and safe to call from several threads at once, as long as nothing adds or removes entities meanwhile.
+  // Reserved entities are added without components the next time entities are added or removed, unless they're
+  // placed with their components first (see `Commands`).
+  Entity reserveEntity() {
+    const auto n = reserved.value.fetch_add(1, std::memory_order_relaxed);
+
+    // Same order as `allocateEntity`: free slots from the back, then new ones.
+    if (n < freeIndices.size()) {
+      const auto index = freeIndices[freeIndices.size() - 1 - n];
+      return Entity{.index = index, .generation = entityRecords[index].generation};
+    }
+
+    return Entity{.index = static_cast<u32>(entityRecords.size() + (n - freeIndices.size())), .generation = 0};
+  }
 
+  // Adds the reserved entities, without components.
+  void flushReservedEntities() {
+    if (reserved.value.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+
+    placeWithoutComponents(allocateReservedEntities());
+  }
+
+  // The entity's slot is freed to be reused by the next added entity.
+  void removeEntity(Entity eid) {
+    flushReservedEntities();
+
+    if (!isAlive(eid)) {
+      std::cerr << "Attempt to remove an entity that doesn't exist.\n";
+      return;
+    }
+
+    auto &record = entityRecords[eid.index];
+    removeRow(record.location);
+
+    sparseComponents.forEach([&](ComponentId id) {
+      componentOperations[id]->removeFromSet(sparseSets[id], eid.index);
+    });
+
+    record.location = EntityLocation{};
+    record.generation++;
+    freeIndices.push_back(eid.index);
+  }
+
+  // Adds `comp` to the entity, or replaces it if the entity already has one.
+  // For table components, the entity moves to the archetype with the extra component.
   template <typename T>
-  std::optional<OptIter<T>> getEntityComponentIter(Entity eid) {
-    auto compVec = getComponentVector<T>();
+  void insert(Entity eid, T &&comp) {
+    using Comp = std::decay_t<T>;
 
-    if (!compVec.has_value()) {
-      return {};
+    flushReservedEntities();
+
+    if (!isAlive(eid)) {
+      std::cerr << "Attempt to add a component to an entity that doesn't exist.\n";
+      return;
     }
 
-    return compVec->get().begin() + eid;
+    lazilyRegisterComponentOperations<Comp>();
+
+    if constexpr (isSparse<Comp>) {
+      sparseSet<Comp>().insert(eid, std::forward<T>(comp), changeTick);
+    } else {
+      const auto location = entityRecords[eid.index].location;
+
+      if (archetypes[location.archetype].has(componentId<Comp>())) {
+        // Tags have nothing to replace.
+        if constexpr (!isTag<Comp>) {
+          auto &column = archetypes[location.archetype].template columnOf<Comp>(location.chunk);
+
+          column.template as<Comp>()[location.row] = std::forward<T>(comp);
+          column.changed[location.row]             = changeTick;
+        }
+        return;
+      }
+
+      const auto dstId = archetypeWith(location.archetype, componentId<Comp>());
+      auto      &chunk = moveToArchetype(eid, dstId);
+
+      addComponent(archetypes[dstId], chunk, eid, std::forward<T>(comp));
+    }
   }
 
+  // Removes the entity's `T`, if it has one.
+  // For table components, the entity moves to the archetype without that component.
+  template <typename T>
+  void remove(Entity eid) {
+    flushReservedEntities();
+
+    if (!isAlive(eid)) {
+      std::cerr << "Attempt to remove a component from an entity that doesn't exist.\n";
+      return;
+    }
+
+    if (!isRegistered(componentId<T>())) {
+      return;
+    }
+
+    if constexpr (isSparse<T>) {
+      auto &set = sparseSet<T>();
+      if (set.contains(eid.index)) {
+        set.remove(eid.index);
+      }
+    } else {
+      const auto location = entityRecords[eid.index].location;
+
+      if (archetypes[location.archetype].has(componentId<T>())) {
+        moveToArchetype(eid, archetypeWithout(location.archetype, componentId<T>()));
+      }
+    }
+  }
+
+  bool isRegistered(ComponentId id) const {
+    return id < componentOperations.size() && componentOperations[id] != nullptr;
+  }
+
+  // Whether every component a query needs an entity to have has been seen. Optional and excluded ones don't count.
   template <typename... Ts>
-  EntityQueryResult<Ts...> getEntityComponents(uint entityId) {
-    return std::make_tuple(getEntityComponentIter<Ts>(entityId)...);
+  bool queryComponentsExist() {
+    return ((QueryTerm<Ts>::presence != Presence::Required || isRegistered(componentId<TermComponent<Ts>>())) && ...);
   }
 
+  // Calls `fn` with every archetype that has all the components in `required` and none of those in `excluded`.
+  // ANDs together the archetype bitsets of each component (inverted for excluded ones) and skips over non-matching
+  // archetypes a word at a time.
+  template <typename F>
+  void forEachArchetypeWith(const ComponentMask &required, const ComponentMask &excluded, F &&fn) {
+    auto words = static_cast<u32>((archetypes.size() + 63) / 64);
+    required.forEach([&](ComponentId id) {
+      words = std::min<u32>(words, id < archetypesWith.size() ? archetypesWith[id].size() : 0);
+    });
+
+    for (u32 w = 0; w < words; w++) {
+      const auto remaining = archetypes.size() - w * 64;
+      auto       bits      = remaining >= 64 ? ~u64(0) : (u64(1) << remaining) - 1;
+
+      required.forEach([&](ComponentId id) { bits &= archetypesWith[id][w]; });
+      excluded.forEach([&](ComponentId id) {
+        if (id < archetypesWith.size() && w < archetypesWith[id].size()) {
+          bits &= ~archetypesWith[id][w];
+        }
+      });
+
+      for (; bits != 0; bits &= bits - 1) {
+        fn(archetypes[w * 64 + std::countr_zero(bits)]);
+      }
+    }
+  }
+
+  // Adds the archetypes created since `matches` was last updated that have all of `required` and none of `excluded`.
+  void updateMatches(ArchetypeMatches &matches, const ComponentMask &required, const ComponentMask &excluded) const {
+    if (matches.generation != generation) {
+      matches            = ArchetypeMatches{};
+      matches.generation = generation;
+    }
+
+    for (; matches.checked < archetypes.size(); matches.checked++) {
+      const auto &mask = archetypes[matches.checked].mask;
+
+      if (mask.containsAll(required) && !mask.intersects(excluded)) {
+        matches.archetypes.push_back(matches.checked);
+      }
+    }
+  }
+
+  // Only valid once a `T` has been added to the container.
+  template <typename T>
+  SparseSet<std::remove_cvref_t<T>> &sparseSet() {
+    return std::any_cast<SparseSet<std::remove_cvref_t<T>> &>(sparseSets[componentId<T>()]);
+  }
+
+  // `ticks` are those of the system running the query, outside of systems every component counts as new.
   template <typename... Ts>
-  bool allComponentsExist() {
-    return (getComponentVector<Ts>().has_value() && ...);
+  requires(sizeof...(Ts) > 0)
+  std::optional<MultiIterator<Ts...>> getQueryIter(Query<Ts...> && /*DUMMY*/, std::optional<SystemTicks> ticks = {}) {
+    if (!queryComponentsExist<Ts...>()) {
+      std::cerr << "Attempt to run a system with no available components (" << typeid(std::tuple<Ts...>).name()
+                << ").\n";
+      return std::nullopt;
+    }
+
+    return MultiIterator<Ts...>(*this, ticks.value_or(SystemTicks{.lastRun = 0, .thisRun = changeTick}));
   }
 
+  // Same, for a query run again and again (see `MultiIterator::Cache`): only the archetypes created since its last run
+  // are matched against it, and the views it built are reused.
   template <typename... Ts>
   requires(sizeof...(Ts) > 0)
-  std::optional<MultiIterator<Ts...>> getQueryIter(Query<Ts...> && /*DUMMY*/) {
-    if (!allComponentsExist<Ts...>()) {
+  std::optional<MultiIterator<Ts...>>
+  getQueryIter(Query<Ts...> && /*DUMMY*/, typename MultiIterator<Ts...>::Cache &cache, SystemTicks ticks) {
+    if (!queryComponentsExist<Ts...>()) {
       std::cerr << "Attempt to run a system with no available components (" << typeid(std::tuple<Ts...>).name()
                 << ").\n";
       return std::nullopt;
     }
 
-    return MultiIterator<Ts...>(*this);
+    return MultiIterator<Ts...>(*this, ticks, cache);
+  }
+
+  // The components of `eid`, as iterating over `Query<Ts...>` would yield them, or nothing if it doesn't match.
+  // Goes straight to the entity's row through `entityRecords`, whatever the number of entities.
+  template <typename... Ts>
+  requires(sizeof...(Ts) > 0)
+  std::optional<FetchTuple<Ts...>> get(Entity eid) {
+    const auto ticks = SystemTicks{.lastRun = 0, .thisRun = changeTick};
+
+    if (!queryComponentsExist<Ts...>()) {
+      return std::nullopt;
+    }
+
+    const auto sets = MultiIterator<Ts...>::findSparseSets(*this);
+    if (!MultiIterator<Ts...>::matchesEntity(*this, sets, eid, ticks)) {
+      return std::nullopt;
+    }
+
+    return MultiIterator<Ts...>::fetchEntity(*this, sets, eid, ticks);
+  }
+
+  // Calls `fn` with the components of each of `eids` that matches `Query<Ts...>`, see `get`.
+  template <typename... Ts, typename F>
+  requires(sizeof...(Ts) > 0)
+  void getMany(std::span<const Entity> eids, F &&fn) {
+    if (!queryComponentsExist<Ts...>()) {
+      return;
+    }
+
+    const auto ticks = SystemTicks{.lastRun = 0, .thisRun = changeTick};
+    const auto sets  = MultiIterator<Ts...>::findSparseSets(*this);
+    for (const auto eid : eids) {
+      if (MultiIterator<Ts...>::matchesEntity(*this, sets, eid, ticks)) {
+        std::apply(fn, MultiIterator<Ts...>::fetchEntity(*this, sets, eid, ticks));
+      }
+    }
   }
 
   void clear() {
-    componentVectors.clear();
+    archetypes.clear();
+    archetypeIndices.clear();
+    archetypesWith.clear();
+    entityRecords.clear();
+    freeIndices.clear();
     componentOperations.clear();
-    numEntities = 0;
+    sparseSets.clear();
+    sparseComponents = ComponentMask{};
+    tagComponents    = ComponentMask{};
+    reserved.value   = 0;
+    generation++;
   }
 
 private:
   template <typename T>
-  void addComponent(T comp) {
-    auto compVec                = getComponentVector<T>();
-    compVec->get()[numEntities] = comp;
+  void addComponent(Archetype &archetype, Chunk &chunk, Entity eid, T &&comp) {
+    using Comp = std::decay_t<T>;
+
+    if constexpr (isSparse<Comp>) {
+      sparseSet<Comp>().insert(eid, std::forward<T>(comp), changeTick);
+    } else if constexpr (!isTag<Comp>) {
+      auto &column = chunk.columns[archetype.columnIndex(componentId<Comp>())];
+      column.template push<Comp>(std::forward<T>(comp));
+    }
   }
 
+  // `nullptr` for sparse set components and tags.
   template <typename T>
-  void lazilyInitComponentVector() {
-    if (!componentVectors.contains(typeid(T))) {
-      componentVectors.insert({typeid(T), std::make_any<Vector<T>>(numEntities)});
+  Column *tableColumn(Archetype &archetype, Chunk &chunk) {
+    if constexpr (isSparse<T> || isTag<T>) {
+      return nullptr;
+    } else {
+      return &chunk.columns[archetype.columnIndex(componentId<T>())];
     }
   }
 
   template <typename T>
-  void lazilyRegisterComponentOperations() {
-    if (auto f = componentOperations.find(typeid(T)); f == componentOperations.end()) {
-      auto dummyPusher = [this]() { getComponentVector<T>()->get().push_back(std::nullopt); };
+  void pushComponent(Column *column, Entity eid, T &&comp) {
+    if constexpr (isSparse<T>) {
+      sparseSet<std::decay_t<T>>().insert(eid, std::forward<T>(comp), changeTick);
+    } else if constexpr (!isTag<T>) {
+      column->push<std::decay_t<T>>(std::forward<T>(comp));
+    }
+  }
 
-      auto moveComponent = [this](ComponentContainer &oth, Entity sourceId, Entity destId) {
-        auto selfVec  = getComponentVector<T>();
-        auto otherVec = oth.getComponentVector<T>();
+  // Allocates `count` entities with components `Ts` and fills the archetype's chunks one run at a time, see
+  // `placeBatch`.
+  template <typename... Ts, typename W>
+  std::vector<Entity> addBatch(u32 count, W &&write) {
+    flushReservedEntities();
 
-        // FIXME: Need to check if either vector doesn't exist
-        otherVec.value().get()[destId] = std::move(selfVec.value().get()[sourceId]);
-      };
+    std::vector<Entity> eids;
+    eids.reserve(count);
 
-      auto removeComponent = [this](Entity eid) {
-        auto compVec = getComponentVector<T>();
-        if (compVec) {
-          compVec.value().get()[eid] = std::nullopt;
-        } else {
-          std::cerr << "Attempt to remove a component that doesn't exist.\n";
-        }
-      };
+    const auto reused = std::min<u32>(count, freeIndices.size());
+    entityRecords.reserve(entityRecords.size() + (count - reused));
+    for (u32 i = 0; i < count; i++) {
+      eids.push_back(allocateEntity());
+    }
+
+    placeBatch<Ts...>(eids, std::forward<W>(write));
+    return eids;
+  }
+
+  // Gives allocated entities that don't have a location yet a row in the archetype of `Ts`.
+  // `write(archetype, chunk, first, run)` must push the components of `run`, the entities [first, first + run.size())
+  // of the batch, which were just appended to `chunk`.
+  template <typename... Ts, typename W>
+  void placeBatch(std::span<const Entity> eids, W &&write) {
+    (lazilyRegisterComponentOperations<Ts>(), ...);
+
+    const auto archetypeId = getOrCreateArchetype(tableMask<Ts...>());
+    const auto count       = static_cast<u32>(eids.size());
+
+    for (u32 first = 0; first < count;) {
+      auto      &archetype = archetypes[archetypeId];
+      auto      &chunk     = allocateRow(archetypeId, eids[first]);
+      const auto n         = std::min(count - first, chunk.capacity - chunk.size() + 1);
+
+      for (u32 i = first + 1; i < first + n; i++) {
+        appendRow(archetypeId, chunk, eids[i]);
+      }
+
+      write(archetype, chunk, first, eids.subspan(first, n));
+      first += n;
+    }
+  }
+
+  std::any &getOrCreateSparseSet(ComponentId id) {
+    auto &set = sparseSets[id];
+    if (!set.has_value()) {
+      set = componentOperations[id]->makeSparseSet();
+    }
+
+    return set;
+  }
+
+  // Allocates the reserved entities, in the order they were reserved. They don't have a location yet.
+  std::vector<Entity> allocateReservedEntities() {
+    const auto count = reserved.value.exchange(0, std::memory_order_relaxed);
+
+    std::vector<Entity> eids;
+    eids.reserve(count);
+    for (u32 i = 0; i < count; i++) {
+      eids.push_back(allocateEntity());
+    }
+
+    return eids;
+  }
+
+  // Gives the entities that don't have a location yet a row in the archetype without components.
+  void placeWithoutComponents(std::span<const Entity> eids) {
+    const auto archetypeId = getOrCreateArchetype(ComponentMask{});
+
+    for (const auto eid : eids) {
+      if (!entityRecords[eid.index].location.valid()) {
+        allocateRow(archetypeId, eid);
+      }
+    }
+  }
+
+  // Reuses the slot of a removed entity if there is one.
+  Entity allocateEntity() {
+    if (!freeIndices.empty()) {
+      const auto index = freeIndices.back();
+      freeIndices.pop_back();
+
+      return Entity{.index = index, .generation = entityRecords[index].generation};
+    }
+
+    entityRecords.emplace_back();
+    return Entity{.index = static_cast<u32>(entityRecords.size() - 1), .generation = 0};
+  }
+
+  // Follows (or creates) the archetype graph edge for adding `id` to `src`.
+  u32 archetypeWith(u32 src, ComponentId id) {
+    if (auto edge = archetypes[src].addEdge(id); edge != Archetype::noEdge) {
+      return edge;
+    }
+
+    auto mask = archetypes[src].mask;
+    mask.set(id);
+
+    const auto dst = getOrCreateArchetype(mask);
+    archetypes[src].setAddEdge(id, dst);
+    archetypes[dst].setRemoveEdge(id, src);
+
+    return dst;
+  }
 
-      componentOperations.insert({typeid(T), ComponentOperation{dummyPusher, moveComponent, removeComponent}});
+  // Follows (or creates) the archetype graph edge for removing `id` from `src`.
+  u32 archetypeWithout(u32 src, ComponentId id) {
+    if (auto edge = archetypes[src].removeEdge(id); edge != Archetype::noEdge) {
+      return edge;
     }
+
+    auto mask = archetypes[src].mask;
+    mask.reset(id);
+
+    const auto dst = getOrCreateArchetype(mask);
+    archetypes[src].setRemoveEdge(id, dst);
+    archetypes[dst].setAddEdge(id, src);
+
+    return dst;
+  }
+
+  // Moves the entity's row to the end of archetype `dstId`, carrying over every column both archetypes share and
+  // dropping the rest. Components only `dstId` has are left for the caller to push.
+  Chunk &moveToArchetype(Entity eid, u32 dstId) {
+    const auto srcLocation = entityRecords[eid.index].location;
+    auto      &dstChunk    = allocateRow(dstId, eid);
+    auto      &src         = archetypes[srcLocation.archetype];
+    auto      &dst         = archetypes[dstId];
+    auto      &srcChunk    = src.chunks[srcLocation.chunk];
+
+    for (u32 col = 0; col < src.signature.size(); col++) {
+      const auto id = src.signature[col];
+
+      if (dst.has(id)) {
+        auto &srcColumn = srcChunk.columns[col];
+        auto &dstColumn = dstChunk.columns[dst.columnIndex(id)];
+
+        componentOperations[id]->moveComponent(srcColumn, srcLocation.row, dstColumn);
+        dstColumn.added.back()   = srcColumn.added[srcLocation.row];
+        dstColumn.changed.back() = srcColumn.changed[srcLocation.row];
+      }
+    }
+
+    removeRow(srcLocation);
+    return dstChunk;
+  }
+
+  // Swaps the last entity of the archetype into the given row to keep chunks packed.
+  void removeRow(EntityLocation location) {
+    auto &archetype = archetypes[location.archetype];
+    auto &chunk     = archetype.chunks[location.chunk];
+    auto &lastChunk = archetype.chunks.back();
+
+    for (u32 col = 0; col < archetype.signature.size(); col++) {
+      componentOperations[archetype.signature[col]]->removeComponent(
+          chunk.columns[col], location.row, lastChunk.columns[col]
+      );
+      chunk.columns[col].removeTicks(location.row, lastChunk.columns[col]);
+    }
+
+    const auto removedEntity = chunk.entities[location.row];
+    const auto movedEntity   = lastChunk.entities.back();
+
+    if (movedEntity != removedEntity) {
+      chunk.entities[location.row]              = movedEntity;
+      entityRecords[movedEntity.index].location = location;
+    }
+
+    lastChunk.entities.pop_back();
+    rowsVersion++;
+
+    if (lastChunk.entities.empty()) {
+      archetype.chunks.pop_back();
+    }
+  }
+
+  u32 getOrCreateArchetype(const ComponentMask &mask) {
+    if (auto found = archetypeIndices.find(mask); found != archetypeIndices.end()) {
+      return found->second;
+    }
+
+    const auto archetypeId = static_cast<u32>(archetypes.size());
+    auto      &archetype   = archetypes.emplace_back(mask, tagComponents);
+    archetypeIndices.insert({mask, archetypeId});
+
+    // Entity ID, then each component and its two ticks.
+    auto rowBytes = static_cast<u32>(sizeof(Entity));
+    for (const auto id : archetype.signature) {
+      rowBytes += componentOperations[id]->size + 2 * sizeof(u32);
+    }
+    archetype.setRowSize(rowBytes);
+
+    mask.forEach([&](ComponentId id) {
+      if (id >= archetypesWith.size()) {
+        archetypesWith.resize(id + 1);
+      }
+
+      archetypesWith[id].resize(archetypeId / 64 + 1, 0);
+      archetypesWith[id][archetypeId / 64] |= u64(1) << (archetypeId % 64);
+    });
+
+    return archetypeId;
+  }
+
+  // Reserves a row for `eid` at the end of the archetype, creating a new chunk if the last one is full.
+  // The caller is expected to push one component to each column of the returned chunk.
+  Chunk &allocateRow(u32 archetypeId, Entity eid) {
+    auto &archetype = archetypes[archetypeId];
+
+    if (archetype.chunks.empty() || archetype.chunks.back().size() == archetype.chunks.back().capacity) {
+      const auto capacity = archetype.nextChunkCapacity();
+      auto      &chunk    = archetype.chunks.emplace_back();
+      chunk.capacity      = capacity;
+      chunk.entities.reserve(capacity);
+
+      chunk.columns.reserve(archetype.signature.size());
+      for (const auto id : archetype.signature) {
+        auto &column = chunk.columns.emplace_back(componentOperations[id]->makeColumn(capacity));
+        column.added.reserve(capacity);
+        column.changed.reserve(capacity);
+      }
+    }
+
+    auto &chunk = archetype.chunks.back();
+    appendRow(archetypeId, chunk, eid);
+
+    return chunk;
+  }
+
+  // Appends `eid` to the last chunk of the archetype, which must have room for it.
+  // Its components are stamped as added now.
+  void appendRow(u32 archetypeId, Chunk &chunk, Entity eid) {
+    entityRecords[eid.index].location = EntityLocation{
+        .archetype = archetypeId,
+        .chunk     = static_cast<u32>(archetypes[archetypeId].chunks.size() - 1),
+        .row       = chunk.size(),
+    };
+    chunk.entities.push_back(eid);
+    rowsVersion++;
+
+    for (auto &column : chunk.columns) {
+      column.pushTicks(changeTick, changeTick);
+    }
+  }
+
+  void registerComponentOperations(ComponentId id, const ComponentOperation *op) {
+    if (id >= componentOperations.size()) {
+      componentOperations.resize(id + 1, nullptr);
+      sparseSets.resize(id + 1);
+    }
+
+    componentOperations[id] = op;
+
+    if (componentOperations[id]->storage == StorageType::SparseSet) {
+      sparseComponents.set(id);
+      getOrCreateSparseSet(id);
+    }
+
+    if (componentOperations[id]->tag) {
+      tagComponents.set(id);
+    }
+  }
+
+  template <typename T>
+  void lazilyRegisterComponentOperations() {
+    if (!isRegistered(componentId<T>())) {
+      registerComponentOperations(componentId<T>(), &operationsOf<T>());
+    }
+  }
+
+  template <typename T>
+  static const ComponentOperation &operationsOf() {
+    static constexpr ComponentOperation operations{
+        .storage    = ComponentStorage<T>::type,
+        .tag        = isTag<T>,
+        .size       = isTag<T> ? 0 : static_cast<u32>(sizeof(T)),
+        .makeColumn = [](u32 capacity) { return Column::make<T>(capacity); },
+
+        .moveComponent = [](Column &src, u32 srcRow, Column &dst) { dst.push<T>(std::move(src.as<T>()[srcRow])); },
+
+        .removeComponent =
+            [](Column &column, u32 row, Column &last) {
+              auto &comp = column.as<T>()[row];
+
+              if (&comp != &last.back<T>()) {
+                comp = std::move(last.back<T>());
+              }
+              last.pop<T>();
+            },
+
+        .makeSparseSet = [] { return std::make_any<SparseSet<T>>(); },
+
+        .removeFromSet =
+            [](std::any &set, u32 index) {
+              auto &sparseSet = std::any_cast<SparseSet<T> &>(set);
+
+              if (sparseSet.contains(index)) {
+                sparseSet.remove(index);
+              }
+            },
+    };
+
+    return operations;
   }
 };
 
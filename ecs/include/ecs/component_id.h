@@ -0,0 +1,46 @@
+#pragma once
+
+#include "defs.h"
+
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <type_traits>
+
+// Upper bound on the number of distinct component types, sizes the component bitmasks.
+#ifndef ECS_MAX_COMPONENTS
+#define ECS_MAX_COMPONENTS 256
+#endif
+
+namespace ecs {
+
+// Small, dense integer identifying a component type.
+// Used to index flat arrays instead of hashing `std::type_index`.
+using ComponentId = u32;
+
+constexpr u32 maxComponents = ECS_MAX_COMPONENTS;
+
+inline ComponentId nextComponentId() {
+  static std::atomic<ComponentId> next = 0;
+
+  const auto id = next++;
+  if (id >= maxComponents) {
+    std::cerr << "Too many component types, define ECS_MAX_COMPONENTS to be larger than " << maxComponents << '\n';
+    std::terminate();
+  }
+
+  return id;
+}
+
+// Assigned the first time a type is used, then stable for the rest of the process.
+template <typename T>
+ComponentId componentId() {
+  if constexpr (!std::is_same_v<T, std::remove_cvref_t<T>>) {
+    return componentId<std::remove_cvref_t<T>>();
+  } else {
+    static const ComponentId id = nextComponentId();
+    return id;
+  }
+}
+
+} // namespace ecs
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "component_id.h"
+#include "defs.h"
+
+#include <array>
+#include <bit>
+
+namespace ecs {
+
+// One bit per component type.
+// Archetypes carry the mask of the components their entities have, queries carry the mask of the components they
+// need, and matching is a word-wise AND/compare.
+struct ComponentMask {
+  static constexpr u32 wordCount = (maxComponents + 63) / 64;
+
+  std::array<u64, wordCount> words{};
+
+  void set(ComponentId id) { words[id / 64] |= u64(1) << (id % 64); }
+  void reset(ComponentId id) { words[id / 64] &= ~(u64(1) << (id % 64)); }
+  bool test(ComponentId id) const { return words[id / 64] & (u64(1) << (id % 64)); }
+
+  bool none() const {
+    for (const auto word : words) {
+      if (word != 0) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  ComponentMask without(const ComponentMask &other) const {
+    ComponentMask result;
+    for (u32 w = 0; w < wordCount; w++) {
+      result.words[w] = words[w] & ~other.words[w];
+    }
+    return result;
+  }
+
+  bool intersects(const ComponentMask &other) const {
+    for (u32 w = 0; w < wordCount; w++) {
+      if ((words[w] & other.words[w]) != 0) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool containsAll(const ComponentMask &other) const {
+    for (u32 w = 0; w < wordCount; w++) {
+      if ((words[w] & other.words[w]) != other.words[w]) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Calls `fn` with the ID of each set bit, in increasing order.
+  template <typename F>
+  void forEach(F &&fn) const {
+    for (u32 w = 0; w < wordCount; w++) {
+      for (auto bits = words[w]; bits != 0; bits &= bits - 1) {
+        fn(static_cast<ComponentId>(w * 64 + std::countr_zero(bits)));
+      }
+    }
+  }
+
+  bool operator==(const ComponentMask &rhs) const = default;
+
+  struct Hasher {
+    std::size_t operator()(const ComponentMask &mask) const noexcept {
+      std::size_t seed = 0;
+      for (const auto word : mask.words) {
+        seed ^= std::hash<u64>{}(word) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+      }
+      return seed;
+    }
+  };
+};
+
+// Computed once per set of types.
+template <typename... Ts>
+const ComponentMask &componentMask() {
+  static const ComponentMask mask = [] {
+    ComponentMask m;
+    (m.set(componentId<Ts>()), ...);
+    return m;
+  }();
+
+  return mask;
+}
+
+} // namespace ecs
@@ -4,21 +4,21 @@
 #include <optional>
 #include <vector>
 
+using u64 = uint64_t;
 using u32 = uint32_t;
 using u8  = uint8_t;
 using f32 = float;
 
 namespace ecs {
-using Entity = std::uint32_t;
 
-template <typename T>
-using Vector = typename std::vector<std::optional<T>>;
+// Handle to an entity: a slot in the entity table plus the generation of that slot when the handle was made.
+// Slots are reused once their entity is removed, bumping the generation so stale handles can be told apart.
+struct Entity {
+  u32 index      = UINT32_MAX;
+  u32 generation = 0;
 
-template <typename T>
-using OptIter = typename Vector<T>::iterator;
-
-template <typename T>
-using Iter = typename std::vector<T>::iterator;
+  bool operator==(const Entity &rhs) const = default;
+};
 
 template <typename... Ts>
 using Query = std::tuple<Ts...>;
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "defs.h"
+
+#include <algorithm>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+
+template <typename T>
+class EventRange;
+
+template <typename T>
+struct EventCursor;
+
+// A channel of `T` events, any number of them per frame.
+// Storage is double buffered: events sent during a frame stay readable during that frame and the next one, then
+// they're dropped when `update` swaps the buffers. Both buffers keep their capacity, so sending doesn't allocate
+// once the channel has seen a busy frame.
+// Each reader keeps its own cursor (an `EventCursor`, or the one of a system's `EventReader`), and sees every event
+// once.
+template <typename T>
+class Events {
+public:
+  void send(T event) { current.push_back(std::move(event)); }
+
+  template <typename... Args>
+  void emplace(Args &&...args) {
+    current.emplace_back(std::forward<Args>(args)...);
+  }
+
+  // Called once per frame by the level owning the channel, see `Level::addEvents`.
+  void update() {
+    currentStart += current.size();
+    std::swap(previous, current);
+    current.clear();
+  }
+
+  // Drops every event.
+  void clear() {
+    update();
+    update();
+  }
+
+private:
+  friend struct EventCursor<T>;
+
+  std::vector<T> previous, current;
+  u64            currentStart = 0; // Number of events sent before `current[0]`
+};
+
+// What an `EventReader` hasn't read yet, oldest first.
+template <typename T>
+class EventRange {
+public:
+  class iterator {
+  public:
+    iterator(const EventRange *range, std::size_t i) : range(range), i(i) {}
+
+    const T &operator*() const { return (*range)[i]; }
+
+    iterator &operator++() {
+      i++;
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const = default;
+
+  private:
+    const EventRange *range;
+    std::size_t       i;
+  };
+
+  EventRange(std::span<const T> older, std::span<const T> newer) : older(older), newer(newer) {}
+
+  iterator begin() const { return iterator(this, 0); }
+  iterator end() const { return iterator(this, size()); }
+
+  std::size_t size() const { return older.size() + newer.size(); }
+  bool        empty() const { return size() == 0; }
+
+  const T &operator[](std::size_t i) const { return i < older.size() ? older[i] : newer[i - older.size()]; }
+
+private:
+  std::span<const T> older, newer;
+};
+
+// Cursor into an `Events<T>` channel. Systems take an `EventReader` instead.
+template <typename T>
+struct EventCursor {
+  u64 next = 0; // Number of events sent before the first unread one
+
+  // The events sent since the last read. Events that were already dropped are skipped.
+  EventRange<T> read(const Events<T> &events) {
+    const auto previousStart = events.currentStart - events.previous.size();
+    const auto first         = std::max(next, previousStart);
+
+    next = events.currentStart + events.current.size();
+
+    const auto inPrevious = std::min<u64>(first - previousStart, events.previous.size());
+    const auto inCurrent  = first > events.currentStart ? first - events.currentStart : 0;
+
+    return EventRange<T>(
+        std::span<const T>(events.previous).subspan(inPrevious), std::span<const T>(events.current).subspan(inCurrent)
+    );
+  }
+};
+
+// System parameter reading the level's (or the global) `Events<T>` channel. Each system has a cursor of its own, kept
+// between runs, so any number of systems can read the same channel and each one sees every event.
+template <typename T>
+class EventReader {
+public:
+  EventReader(EventCursor<T> &cursor, const Events<T> &events) : cursor(&cursor), events(&events) {}
+
+  // The events sent since this system last read them.
+  EventRange<T> read() { return cursor->read(*events); }
+
+private:
+  EventCursor<T>  *cursor;
+  const Events<T> *events;
+};
+
+} // namespace ecs
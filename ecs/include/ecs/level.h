@@ -5,12 +5,16 @@
 #include "resources.h"
 #include "component_container.h"
 #include "commands.h"
+#include "events.h"
+#include "schedule.h"
+#include "system.h"
 #include "tuple_utils.h"
 // clang-format on
 
 #include <functional>
 #include <iostream>
 #include <optional>
+#include <span>
 #include <tuple>
 #include <type_traits>
 #include <unordered_map>
@@ -30,16 +34,22 @@ struct Level {
   ComponentContainer components;
 
   // Run every frame
-  std::vector<std::function<void()>> perFrameSystems;
+  // Systems that don't conflict over components (see `SystemAccess`) run in parallel, the others in the order they
+  // were added in.
+  std::vector<System> perFrameSystems;
+  SystemStages        perFrameStages;
 
   // Systems that run when we transition to another level
   // Meant to reset everything to some initial state.
-  std::vector<std::function<void()>> resetSystems;
+  std::vector<System> resetSystems;
 
   // Run whenever the system is fresh (first time, or after a reset)
   // Add entities, systems, and level/global resources.
   std::vector<std::function<void(Resources &, Level &)>> setupSystems;
 
+  // Swap the buffers of the level's event channels, once per frame.
+  std::vector<std::function<void()>> eventUpdates;
+
   Resources  levelResources;
   Resources &globalResources; // Obtained from the ECS instance containing this level.
   bool       hasBeenSetup = false;
@@ -49,20 +59,68 @@ struct Level {
     return components.addEntity(std::forward<Ts>(comps)...);
   }
 
+  // Adds `count` entities, the i-th one getting the components in the `std::tuple` returned by `generator(i)`.
+  template <typename F>
+  std::vector<Entity> addEntities(u32 count, F &&generator) {
+    return components.addEntities(count, std::forward<F>(generator));
+  }
+
+  // Adds one entity per element, the i-th one getting the i-th element of each span.
+  template <typename... Ts>
+  requires(sizeof...(Ts) > 0)
+  std::vector<Entity> addEntities(std::span<const Ts>... comps) {
+    return components.addEntities<Ts...>(comps...);
+  }
+
+  bool isAlive(Entity eid) const { return components.isAlive(eid); }
+
+  // Components of one entity, e.g. `get<Pos2D, const Velocity>(eid)`, or nothing if it doesn't have them.
+  // Don't hold on to them across structural changes, see `insert`.
+  template <typename... Ts>
+  requires(sizeof...(Ts) > 0)
+  std::optional<FetchTuple<Ts...>> get(Entity eid) {
+    return components.get<Ts...>(eid);
+  }
+
+  // Calls `fn` with the components of each entity of `eids` that has them.
+  template <typename... Ts, typename F>
+  requires(sizeof...(Ts) > 0)
+  void getMany(std::span<const Entity> eids, F &&fn) {
+    components.getMany<Ts...>(eids, std::forward<F>(fn));
+  }
+
+  // Adds or replaces a component of an existing entity.
+  // Don't call from inside a system, iterators would be invalidated. Use `Commands::insert` instead.
+  template <typename T>
+  void insert(Entity eid, T &&comp) {
+    components.insert(eid, std::forward<T>(comp));
+  }
+
+  // Removes a component from an existing entity. Same restrictions as `insert`.
+  template <typename T>
+  void remove(Entity eid) {
+    components.remove<T>(eid);
+  }
+
   // 2 possible inputs: resources, queries
   //
   // resources only
   // queries only
   // resources + queries
+  //
+  // Instead of the whole `ResourceBundle`, systems can take handles to the resources they use (`Res<T>`, `ResMut<T>`,
+  // `Option<Res<T>>`, `EventReader<T>`) next to their queries. Those are resolved once, when the system is added or
+  // on its first run once the resource exists (see `BoundHandle`), and let systems using different resources run in
+  // parallel.
 
   // Add system with access to resources only.
   template <typename R, typename F>
-  requires(MatchSignature<F, void, R>)
+  requires(std::is_same_v<ResourceBundle, R> && MatchSignature<F, void, R>)
   void addPerFrameSystem(F &&fn) {
     addSystemResOnly<R>(perFrameSystems, fn);
   }
 
-  // Add system with access to components only.
+  // Add system with access to components and resource handles only.
   template <typename... Query, typename F>
   requires(NoResources<Query...>)
   void addPerFrameSystem(F &&fn) {
@@ -77,7 +135,7 @@ struct Level {
   }
 
   template <typename R, typename F>
-  requires(MatchSignature<F, void, R>)
+  requires(std::is_same_v<ResourceBundle, R> && MatchSignature<F, void, R>)
   void addResetSystem(F &&fn) {
     addSystemResOnly<R>(resetSystems, fn);
   }
@@ -94,11 +152,30 @@ struct Level {
     addSystem<R, Query...>(resetSystems, fn);
   }
 
+  // Adds `Systems` (`StaticSystem`s) as one `Schedule`: they run in order, without going through a `std::function`
+  // each.
+  template <typename... Systems>
+  void addPerFrameSchedule() {
+    addSchedule<Systems...>(perFrameSystems);
+  }
+
+  template <typename... Systems>
+  void addResetSchedule() {
+    addSchedule<Systems...>(resetSystems);
+  }
+
   template <typename R>
   void addResource(R initialValue) {
     levelResources.addResource(initialValue);
   }
 
+  // Adds an `Events<T>` level resource, updated at the end of every frame.
+  template <typename T>
+  void addEvents() {
+    levelResources.addResource(Events<T>{});
+    eventUpdates.push_back([events = levelResources.resMut<Events<T>>()]() { events->update(); });
+  }
+
   template <typename F>
   requires(MatchSignature<F, void, ecs::Resources &, ecs::Level &>)
   void addSetupSystem(F &&fn) {
@@ -109,84 +186,104 @@ struct Level {
   void completeReset() {
     components.clear();
     perFrameSystems.clear();
+    perFrameStages = SystemStages{};
     resetSystems.clear();
+    eventUpdates.clear();
     levelResources.clear();
     hasBeenSetup = false;
   }
 
 private:
-  Entity addEmptyEntity() {
-    // Make space for the new entities
-    for (auto &[_, op] : components.componentOperations) {
-      op.pushDummy();
-    }
-
-    return components.numEntities++;
-  }
-
-  void removeEntity(Entity eid) {
-    for (auto &[_, op] : components.componentOperations) {
-      op.removeComponent(eid);
-    }
-  }
-
-  void copyComponents(Commands &cmd, Entity sourceId, Entity destId) {
-    for (auto &[typeId, anyVec] : cmd.entitiesToAdd.componentVectors) {
-      cmd.entitiesToAdd.componentOperations[typeId].moveComponent(components, sourceId, destId);
-    }
-  }
-
   void processCommands(Commands &cmd) {
-    // Loops over all added entities, creates an empty one in the ECS storage,
-    // then moves over all components from `entitiesToAdd` to the ECS storage.
-    for (uint32_t sourceId = 0; sourceId < cmd.entitiesToAdd.numEntities; sourceId++) {
-      auto destId = addEmptyEntity();
-      copyComponents(cmd, sourceId, destId);
-    }
+    // So systems see what's added or changed here as new next time they run.
+    components.changeTick++;
 
-    for (auto &&eid : cmd.entitiesToRemove) {
-      removeEntity(eid);
-    }
+    cmd.apply(components);
   }
 
   // Add system with access to only to resources.
   template <typename R, typename F>
-  void addSystemResOnly(std::vector<std::function<void()>> &systemCollection, F &&fn) {
-    systemCollection.push_back([this, fn]() {
-      std::invoke(fn, ResourceBundle{.global = globalResources, .level = levelResources});
+  void addSystemResOnly(std::vector<System> &systemCollection, F &&fn) {
+    systemCollection.push_back(System{
+        .run    = [this, fn]() { std::invoke(fn, ResourceBundle{.global = globalResources, .level = levelResources}); },
+        .access = SystemAccess::of(true),
     });
   }
 
-  // Add system WITHOUT access to resources.
-  template <typename... Query, typename F>
-  void addSystemQueryOnly(std::vector<std::function<void()>> &systemCollection, F &&fn) {
-    systemCollection.push_back([this, fn]() {
-      auto queryIters = std::make_tuple(components.getQueryIter(Query{})...);
+  // Add system WITHOUT access to the whole resource maps. Its parameters are queries and resource handles, see
+  // `SystemParam`.
+  template <typename... Params, typename F>
+  void addSystemQueryOnly(std::vector<System> &systemCollection, F &&fn) {
+    const auto states = initParams<Params...>();
 
-      if (allSome(queryIters)) {
-        const auto unwrappedIters = unwrapTuple(queryIters);
-        std::apply(fn, unwrappedIters);
+    auto run = [fn, fetch = paramFetcher<Params...>(states)]() mutable {
+      auto params = fetch();
+
+      if (allSome(params)) {
+        std::apply(fn, unwrapTuple(params));
       }
-    });
+    };
+
+    systemCollection.push_back(System{.run = run, .access = SystemAccess::of<Params...>(false, states)});
   }
 
   // Add system with access to level resources + components.
   //
   // The last part of the requires clause is to get around some weird quirk in the compile where it
   // sees that Query = {void(ecs::ResourceBundle)} and F = void(ecs::ResourceBundle) for some reason.
-  template <typename R, typename... Query, typename F>
-  void addSystem(std::vector<std::function<void()>> &systemCollection, F &&fn) {
-    systemCollection.push_back([this, fn]() {
-      auto queryIters = std::make_tuple(components.getQueryIter(Query{})...);
-
-      if (allSome(queryIters)) {
-        const auto unwrappedIters = unwrapTuple(queryIters);
-        auto       rb             = ResourceBundle{.global = globalResources, .level = levelResources};
-        std::apply(fn, std::tuple_cat(std::make_tuple(rb), unwrappedIters));
+  template <typename R, typename... Params, typename F>
+  void addSystem(std::vector<System> &systemCollection, F &&fn) {
+    const auto states = initParams<Params...>();
+
+    auto run = [this, fn, fetch = paramFetcher<Params...>(states)]() mutable {
+      auto params = fetch();
+
+      if (allSome(params)) {
+        auto rb = ResourceBundle{.global = globalResources, .level = levelResources};
+        std::apply(fn, std::tuple_cat(std::make_tuple(rb), unwrapTuple(params)));
       }
+    };
+
+    systemCollection.push_back(System{.run = run, .access = SystemAccess::of<Params...>(true, states)});
+  }
+
+  template <typename... Systems>
+  void addSchedule(std::vector<System> &systemCollection) {
+    auto schedule = Schedule<Systems...>(ResourceBundle{.global = globalResources, .level = levelResources});
+
+    systemCollection.push_back(System{
+        .run    = [this, schedule]() mutable { schedule.run(components); },
+        .access = schedule.access(),
+        .ticks  = schedule.ticks,
     });
   }
 
+  // Resolves what the parameters of a system need, once, when it's added.
+  template <typename... Params>
+  std::tuple<typename SystemParam<Params>::State...> initParams() {
+    const auto rb = ResourceBundle{.global = globalResources, .level = levelResources};
+    return {SystemParam<Params>::init(rb)...};
+  }
+
+  // Returns a function fetching the parameters of a system before each run.
+  // The system must be skipped if one of them is missing: a query over components that don't exist, or a resource
+  // that isn't there. A skipped run doesn't count as one, changes made until the next actual run are still reported.
+  template <typename... Params>
+  auto paramFetcher(std::tuple<typename SystemParam<Params>::State...> states) {
+    return [this, states = std::move(states), lastRun = u32{0}]() mutable {
+      const auto ticks = SystemTicks{.lastRun = lastRun, .thisRun = components.changeTick};
+
+      auto params = [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+        return std::make_tuple(SystemParam<Params>::fetch(std::get<Is>(states), components, ticks)...);
+      }(std::index_sequence_for<Params...>{});
+
+      if (allSome(params)) {
+        lastRun = ticks.thisRun;
+      }
+      return params;
+    };
+  }
+
   void runSetupSystems() {
     if (hasBeenSetup) {
       std::cout << "Attempt to setup a level that's already been setup\n";
@@ -201,18 +298,26 @@ private:
   }
 
   void runPerFrameSystems() {
-    for (auto &sys : perFrameSystems) {
-      sys();
+    if (auto cmd = levelResources.getResource<Commands>()) {
+      cmd->get().reserveFrom(components);
     }
 
+    perFrameStages.run(perFrameSystems, components.changeTick);
+
     if (auto cmd = levelResources.getResource<Commands>()) {
       processCommands(*cmd);
     }
+
+    for (auto &update : eventUpdates) {
+      update();
+    }
   }
 
   void runResetSystems() {
     for (auto &cleanupSys : resetSystems) {
-      cleanupSys();
+      components.changeTick++;
+      cleanupSys.run();
+      components.changeTick += cleanupSys.ticks - 1;
     }
   }
 };
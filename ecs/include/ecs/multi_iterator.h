@@ -2,139 +2,603 @@
 
 #include "component_container.h"
 #include "defs.h"
+#include "query_terms.h"
+#include "thread_pool.h"
+#include "ticks.h"
 #include "tuple_utils.h"
 
+#include <algorithm>
+#include <array>
+#include <span>
+
 namespace ecs {
 
+// Iterates over all entities that match every term of `Ts` (see `QueryTerm`), yielding the fetched components.
+// Column pointers of every matching run of entities are resolved once when the query is built,
+// iterating is then just bumping those pointers.
+//
+// If any of `Ts` needs a component stored in a sparse set, components aren't contiguous anymore and each matching
+// entity gets a view of its own. Matching entities are then found by walking the smallest of the query's required
+// sparse sets (or the archetypes matching the rest of the query if they hold fewer entities), so a query on a rare
+// component costs O(that component's count).
+//
+// `With`/`Without` on table components are resolved per archetype. `Added`/`Changed` filters, and `Without` on sparse
+// set components, are checked per entity while building the views, so chunks are split into the runs of entities
+// that pass them. Mutable access to a component stamps it as changed.
 template <typename... Ts>
 struct MultiIterator {
+  static constexpr bool perEntity =
+      ((isSparse<TermComponent<Ts>> && QueryTerm<Ts>::presence != Presence::Excluded) || ...);
+  static constexpr bool hasRowFilters =
+      ((QueryTerm<Ts>::filter != TickFilter::None ||
+        (isSparse<TermComponent<Ts>> && QueryTerm<Ts>::presence == Presence::Excluded)) ||
+       ...);
+
+  // Entities per task of the parallel loops, small enough to balance uneven work, big enough to amortize scheduling.
+  static constexpr u32 defaultGrainSize = 256;
+
+  template <typename T>
+  using TermSet = SparseSet<std::remove_cv_t<TermComponent<T>>>;
+
+  using Columns    = std::tuple<TermComponent<Ts> *...>; // Null for excluded or absent optional components
+  using ChangedPtr = std::array<u32 *, sizeof...(Ts)>; // Changed ticks of the terms in `writesComponent`, or null
+  using SparseSets = std::tuple<TermSet<Ts> *...>;     // Null for table components, or if none was ever added
+
+  // A run of entities whose components are contiguous in each column.
+  struct ChunkView {
+    Columns    columns;
+    ChangedPtr changed;
+    u32        size;
+  };
+
+  // Spans of absent optional components are empty.
+  using ChunkTuple = decltype(std::tuple_cat(
+      std::declval<
+          std::conditional_t<QueryTerm<Ts>::fetch, std::tuple<std::span<TermComponent<Ts>>>, std::tuple<>>>()...
+  ));
 
   struct iterator {
     using iterator_category = std::forward_iterator_tag;
-    using element_type      = std::tuple<Iter<Ts>...>;
-    using opt_value_type    = std::tuple<OptIter<Ts>...>;
-    using pointer           = element_type *;
-    using reference         = element_type &;
+    using value_type        = FetchTuple<Ts...>;
+    using reference         = value_type;
     using difference_type   = std::ptrdiff_t;
 
     iterator() = default;
-    iterator(uint offset, uint maxOffset, ComponentContainer *cc) : offset(offset), maxOffset(maxOffset), cc(cc) {}
-
-    static bool allSome(const opt_value_type &iter) {
-      return std::apply([](auto &&...args) { return (args->has_value() && ...); }, iter);
+    iterator(const ChunkView *view, const ChunkView *lastView, u32 thisRun)
+        : view(view), lastView(lastView), thisRun(thisRun) {
+      loadView();
     }
 
-    // Converts from tuple<OptIter<T1>, OptIter<T2>, ...> to tuple<Iter<T1>, Iter<T2>, ...>
-    template <unsigned int N = 0, unsigned int NEnd = sizeof...(Ts) - 1>
-    static auto unwrapIterators(opt_value_type iterTuple) {
-      using T = typename std::tuple_element<N, std::tuple<Ts...>>::type;
-      Iter<T>    comp_it(&(std::get<N>(iterTuple)->value()));
-      const auto t = std::make_tuple(comp_it);
+    reference operator*() const {
+      stampChanged(changed, 1, thisRun);
+      return fetch(columns);
+    }
 
-      if constexpr (N == NEnd) {
-        return t;
+    iterator &operator++() {
+      if (--remaining == 0) {
+        view++;
+        loadView();
       } else {
-        return std::tuple_cat(t, unwrapIterators<N + 1>(iterTuple));
+        columns = advanced(columns, 1);
+        changed = offsetChanged(changed, 1);
       }
+
+      return *this;
     }
 
-    void updateRefHolder(uint offset) {
-      refHolder = unwrapIterators(unwrapTuple(cc->getEntityComponents<Ts...>(offset)));
+    iterator operator++(int) {
+      auto temp = *this;
+      ++(*this);
+      return temp;
     }
 
-    iterator &operator++() {
-      offset++;
+    friend bool operator==(const iterator &a, const iterator &b) {
+      return (a.view == b.view) && (a.remaining == b.remaining);
+    }
 
-      while (offset < maxOffset) {
-        auto compTuple = cc->getEntityComponents<Ts...>(offset);
+  private:
+    void loadView() {
+      if (view != lastView) {
+        columns   = view->columns;
+        changed   = view->changed;
+        remaining = view->size;
+      } else {
+        remaining = 0;
+      }
+    }
 
-        if (ecs::allSome(compTuple) && iterator::allSome(unwrapTuple(compTuple))) {
-          break;
-        }
+    const ChunkView *view = nullptr, *lastView = nullptr;
+    Columns          columns;
+    ChangedPtr       changed{};
+    u32              remaining = 0;
+    u32              thisRun   = 0;
+  };
+
+  // Yields one `std::span` per fetched component for each run of matching entities, so loops over a run can be
+  // vectorized. A run is a whole chunk, or a single entity if any of `Ts` is stored in a sparse set.
+  struct ChunkRange {
+    struct iterator {
+      using iterator_category = std::forward_iterator_tag;
+      using value_type        = ChunkTuple;
+      using reference         = value_type;
+      using difference_type   = std::ptrdiff_t;
 
-        offset++;
+      reference operator*() const { return spans(*view, 0, view->size, thisRun); }
+
+      iterator &operator++() {
+        view++;
+        return *this;
       }
 
-      return *this;
+      iterator operator++(int) {
+        auto temp = *this;
+        ++(*this);
+        return temp;
+      }
+
+      friend bool operator==(const iterator &a, const iterator &b) = default;
+
+      const ChunkView *view    = nullptr;
+      u32              thisRun = 0;
+    };
+
+    iterator begin() const { return iterator{first, thisRun}; }
+    iterator end() const { return iterator{last, thisRun}; }
+
+    const ChunkView *first, *last;
+    u32              thisRun;
+  };
+
+  // What a query run again and again keeps between runs: the archetypes it matched and the views built over their
+  // chunks, along with their capacity. Columns never move, so unless the views depend on row filters or sparse sets,
+  // they stay valid and only the size of the last chunk of each archetype needs refreshing after rows were added or
+  // removed. Nothing is done if no row was.
+  struct Cache {
+    // Views of one of the matched archetypes, one per chunk.
+    struct ArchetypeViews {
+      u32 first;
+      u32 count;
+    };
+
+    ArchetypeMatches            matches;
+    std::vector<ChunkView>      views;
+    std::vector<ArchetypeViews> archetypeViews; // Same order as `matches.archetypes`
+    std::vector<u32>            viewStarts;     // Scratch space of `parallelRuns`
+    SparseSets                  sparseSets{};   // Resolved whenever views are built from sparse sets
+    u32                         generation  = 0; // See `ComponentContainer::generation`
+    u32                         rowsVersion = 0; // See `ComponentContainer::rowsVersion`
+  };
+
+  MultiIterator(ComponentContainer &cc, SystemTicks ticks) : ticks(ticks) {
+    addViews(cc, [&](auto &&fn) { cc.forEachArchetypeWith(requiredMask<Ts...>(), excludedMask<Ts...>(), fn); });
+  }
+
+  // Only the archetypes created since `cache` was last used are matched against the query.
+  MultiIterator(ComponentContainer &cc, SystemTicks ticks, Cache &cache) : ticks(ticks), cache(&cache) {
+    cc.updateMatches(cache.matches, requiredMask<Ts...>(), excludedMask<Ts...>());
+
+    if constexpr (perEntity || hasRowFilters) {
+      cache.views.clear();
+      addViews(cc, [&](auto &&fn) {
+        for (const auto archetype : cache.matches.archetypes) {
+          fn(cc.archetypes[archetype]);
+        }
+      });
+    } else {
+      refreshViews(cc);
     }
+  }
+
+  MultiIterator(const MultiIterator &other)
+      : ticks(other.ticks), owned(other.owned), cache(other.cache == &other.owned ? &owned : other.cache) {}
+
+  MultiIterator(MultiIterator &&other) noexcept
+      : ticks(other.ticks), owned(std::move(other.owned)), cache(other.cache == &other.owned ? &owned : other.cache) {}
 
-    reference operator*() {
-      updateRefHolder(offset);
-      return refHolder;
+  MultiIterator &operator=(MultiIterator other) noexcept {
+    ticks = other.ticks;
+    owned = std::move(other.owned);
+    cache = other.cache == &other.owned ? &owned : other.cache;
+    return *this;
+  }
+
+  iterator begin() const { return iterator(firstView(), lastView(), ticks.thisRun); }
+  iterator end() const { return iterator(lastView(), lastView(), ticks.thisRun); }
+
+  ChunkRange chunks() const { return ChunkRange{firstView(), lastView(), ticks.thisRun}; }
+
+  // Looked up once by callers checking many entities, instead of once per entity and term.
+  static SparseSets findSparseSets(ComponentContainer &cc) {
+    return SparseSets([&]<typename T>() -> TermSet<T> * {
+      if constexpr (isSparse<TermComponent<T>>) {
+        return cc.isRegistered(componentId<TermComponent<T>>()) ? &cc.sparseSet<TermComponent<T>>() : nullptr;
+      } else {
+        return nullptr;
+      }
+    }.template operator()<Ts>()...);
+  }
+
+  // Whether `eid` matches the query, checked without building any view. `sets` comes from `findSparseSets`.
+  static bool matchesEntity(ComponentContainer &cc, const SparseSets &sets, Entity eid, SystemTicks ticks) {
+    if (!cc.isAlive(eid) || !cc.entityRecords[eid.index].location.valid()) {
+      return false;
     }
 
-    pointer operator->() {
-      updateRefHolder(offset);
-      return &refHolder;
+    const auto location  = cc.entityRecords[eid.index].location;
+    auto      &archetype = cc.archetypes[location.archetype];
+
+    return archetype.mask.containsAll(requiredMask<Ts...>()) && !archetype.mask.intersects(excludedMask<Ts...>()) &&
+           inRequiredSparseSets(sets, eid) && passesRowFilters(sets, archetype, location, eid, ticks);
+  }
+
+  // What iterating would yield for `eid`, which must match the query. Mutable components are stamped as changed.
+  static FetchTuple<Ts...> fetchEntity(ComponentContainer &cc, const SparseSets &sets, Entity eid, SystemTicks ticks) {
+    const auto location  = cc.entityRecords[eid.index].location;
+    auto      &archetype = cc.archetypes[location.archetype];
+
+    return std::apply(
+        [&](auto *...termSets) {
+          stampChanged(ChangedPtr{changedPointer<Ts>(termSets, archetype, location, eid)...}, 1, ticks.thisRun);
+          return fetch(Columns(componentPointer<Ts>(termSets, archetype, location, eid)...));
+        },
+        sets
+    );
+  }
+
+  // Splits matching entities into pieces of at most `grainSize` and calls `fn(std::span<Ts>...)` on each run of
+  // contiguous entities of a piece, across the global thread pool. `fn` must be safe to call concurrently.
+  template <typename F>
+  void parChunks(F &&fn, u32 grainSize = defaultGrainSize) const {
+    parallelRuns(grainSize, [&](const ChunkView &view, u32 offset, u32 size) {
+      std::apply(fn, spans(view, offset, size, ticks.thisRun));
+    });
+  }
+
+  // Calls `fn(Ts &...)` on every matching entity, in parallel. `fn` must be safe to call concurrently.
+  template <typename F>
+  void parEach(F &&fn, u32 grainSize = defaultGrainSize) const {
+    parallelRuns(grainSize, [&](const ChunkView &view, u32 offset, u32 size) {
+      stampChanged(offsetChanged(view.changed, offset), size, ticks.thisRun);
+
+      auto columns = advanced(view.columns, offset);
+      for (u32 i = 0; i < size; i++) {
+        std::apply(fn, fetch(columns));
+        columns = advanced(columns, 1);
+      }
+    });
+  }
+
+private:
+  const ChunkView *firstView() const { return cache->views.data(); }
+  const ChunkView *lastView() const { return cache->views.data() + cache->views.size(); }
+
+  static FetchTuple<Ts...> fetch(const Columns &columns) {
+    return std::apply(
+        [](auto *...components) {
+          return std::tuple_cat([]<typename T>(TermComponent<T> *component) {
+            if constexpr (!QueryTerm<T>::fetch) {
+              return std::tuple<>();
+            } else if constexpr (QueryTerm<T>::presence == Presence::Optional) {
+              return std::tuple<TermComponent<T> *>(component);
+            } else {
+              return std::tuple<TermComponent<T> &>(*component);
+            }
+          }.template operator()<Ts>(components)...);
+        },
+        columns
+    );
+  }
+
+  static ChunkTuple spans(const ChunkView &view, u32 offset, u32 size, u32 thisRun) {
+    stampChanged(offsetChanged(view.changed, offset), size, thisRun);
+
+    return std::apply(
+        [&](auto *...components) {
+          return std::tuple_cat([&]<typename T>(TermComponent<T> *component) {
+            using Span = std::span<TermComponent<T>>;
+
+            if constexpr (!QueryTerm<T>::fetch) {
+              return std::tuple<>();
+            } else {
+              return std::tuple<Span>(component != nullptr ? Span(component + offset, size) : Span());
+            }
+          }.template operator()<Ts>(components)...);
+        },
+        view.columns
+    );
+  }
+
+  static Columns advanced(Columns columns, u32 offset) {
+    std::apply(
+        [offset](auto *&...components) {
+          ((components = components != nullptr ? components + offset : nullptr), ...);
+        },
+        columns
+    );
+    return columns;
+  }
+
+  static ChangedPtr offsetChanged(ChangedPtr changed, u32 offset) {
+    for (auto &ticks : changed) {
+      ticks = ticks != nullptr ? ticks + offset : nullptr;
     }
+    return changed;
+  }
 
-    iterator operator++(int) {
-      auto temp = *this;
-      (*this)++;
-      return temp;
+  // Marks the components of the next `size` entities as changed, for every term giving out mutable references.
+  static void stampChanged(const ChangedPtr &changed, u32 size, u32 thisRun) {
+    for (auto *ticks : changed) {
+      if (ticks != nullptr) {
+        std::fill_n(ticks, size, thisRun);
+      }
     }
+  }
 
-    friend bool operator==(const iterator &a, const iterator &b) {
-      return (a.offset == b.offset) && (a.maxOffset == b.maxOffset) && (a.cc == b.cc);
+  // Calls `fn(view, offset, size)` on runs of matching entities, split in pieces of at most `grainSize` across the
+  // global thread pool.
+  template <typename F>
+  void parallelRuns(u32 grainSize, F &&fn) const {
+    const auto &views      = cache->views;
+    auto       &viewStarts = cache->viewStarts; // Index of the first entity of each view
+    viewStarts.clear();
+
+    u32 count = 0;
+    for (const auto &view : views) {
+      viewStarts.push_back(count);
+      count += view.size;
     }
 
-  private:
-    uint                offset = 0, maxOffset = 0;
-    ComponentContainer *cc = nullptr;
-    element_type        refHolder;
-  };
+    ThreadPool::global().parallelFor(count, grainSize, [&](u32 begin, u32 end) {
+      auto v = std::upper_bound(viewStarts.begin(), viewStarts.end(), begin) - viewStarts.begin() - 1;
 
-  MultiIterator(ComponentContainer &cc) {
-    auto validBegin = findValidStart(cc);
-    auto validEnd   = findValidEnd(cc);
+      for (; begin < end; v++) {
+        const auto offset = begin - viewStarts[v];
+        const auto size   = std::min(end - begin, views[v].size - offset);
 
-    _begin = iterator(validBegin, validEnd, &cc);
-    _end   = iterator(validEnd, validEnd, &cc);
+        fn(views[v], offset, size);
+        begin += size;
+      }
+    });
   }
 
-  // Need to find the first iterator to have all components so dereferencing works properly.
-  // If none exist, we'll return what's equivalent to `begin()`
-  static uint findValidStart(ComponentContainer &cc) {
-    for (auto current = 0u; current != cc.numEntities; current++) {
-      auto iters = cc.getEntityComponents<Ts...>(current);
-      if (!allSome(iters)) {
-        continue;
+  // Brings the views of `cache` up to date with the rows of its archetypes, see `Cache`.
+  void refreshViews(ComponentContainer &cc) {
+    auto &views          = cache->views;
+    auto &archetypeViews = cache->archetypeViews;
+
+    // The container was cleared and the matches started over.
+    if (cache->generation != cc.generation) {
+      views.clear();
+      archetypeViews.clear();
+    } else if (cache->rowsVersion == cc.rowsVersion && archetypeViews.size() == cache->matches.archetypes.size()) {
+      return;
+    }
+
+    for (u32 i = 0; i < archetypeViews.size(); i++) {
+      const auto &archetype = cc.archetypes[cache->matches.archetypes[i]];
+      const auto  viewed    = archetypeViews[i];
+
+      // A chunk was added or freed, the views of this archetype and the ones after it are built again.
+      if (archetype.chunks.size() != viewed.count) {
+        views.resize(viewed.first);
+        archetypeViews.resize(i);
+        break;
       }
 
-      if (iterator::allSome(unwrapTuple(iters)))
-        return current;
+      if (viewed.count > 0) {
+        views[viewed.first + viewed.count - 1].size = archetype.chunks.back().size();
+      }
+    }
+
+    for (auto i = static_cast<u32>(archetypeViews.size()); i < cache->matches.archetypes.size(); i++) {
+      const auto first = static_cast<u32>(views.size());
+      addChunkViews(cc, [&](auto &&fn) { fn(cc.archetypes[cache->matches.archetypes[i]]); });
+      archetypeViews.push_back({.first = first, .count = static_cast<u32>(views.size()) - first});
     }
 
-    return 0;
+    cache->generation  = cc.generation;
+    cache->rowsVersion = cc.rowsVersion;
+  }
+
+  // `forEachArchetype(fn)` calls `fn` with every archetype matching the query.
+  template <typename F>
+  void addViews(ComponentContainer &cc, F &&forEachArchetype) {
+    cache->sparseSets = findSparseSets(cc);
+
+    if constexpr (perEntity) {
+      addEntityViews(cc, forEachArchetype);
+    } else {
+      addChunkViews(cc, forEachArchetype);
+    }
+  }
+
+  template <typename F>
+  void addChunkViews(ComponentContainer &cc, F &&forEachArchetype) {
+    forEachArchetype([&](Archetype &archetype) {
+      for (u32 chunk = 0; chunk < archetype.chunks.size(); chunk++) {
+        const auto &entities = archetype.chunks[chunk].entities;
+
+        if constexpr (!hasRowFilters) {
+          addView(archetype, EntityLocation{.chunk = chunk, .row = 0}, entities[0], entities.size());
+          continue;
+        }
+
+        auto passes = [&](u32 row) {
+          const auto location = EntityLocation{.chunk = chunk, .row = row};
+          return passesRowFilters(cache->sparseSets, archetype, location, entities[row], ticks);
+        };
+
+        for (u32 row = 0; row < entities.size(); row++) {
+          if (!passes(row)) {
+            continue;
+          }
+
+          const auto first = row;
+          while (row + 1 < entities.size() && passes(row + 1)) {
+            row++;
+          }
+
+          addView(archetype, EntityLocation{.chunk = chunk, .row = first}, entities[first], row - first + 1);
+        }
+      }
+    });
   }
 
-  // Need to find the last iterator to have all components so dereferencing works properly.
-  // If none exist, we'll return what's equivalent to `begin()`
-  static uint findValidEnd(ComponentContainer &cc) {
-    // Should be called `firstAnyNoneAfterLastAllSome` but that's just too long
-    auto current = static_cast<int>(cc.numEntities - 1);
-    for (; current >= 0; current--) {
-      auto iters = cc.getEntityComponents<Ts...>(current);
+  template <typename F>
+  void addEntityViews(ComponentContainer &cc, F &&forEachArchetype) {
+    const auto                &sets        = cache->sparseSets;
+    const std::vector<Entity> *smallestSet = nullptr;
 
-      // One of the Ts doesn't have a component vector (no entity has that component)
-      if (!allSome(iters)) {
-        continue;
+    auto findSmallestSet = [&]<typename T>(const TermSet<T> *set) {
+      if constexpr (isSparse<TermComponent<T>> && QueryTerm<T>::presence == Presence::Required) {
+        if (smallestSet == nullptr || set->size() < smallestSet->size()) {
+          smallestSet = &set->entities;
+        }
+      }
+    };
+    std::apply([&](auto *...termSets) { (findSmallestSet.template operator()<Ts>(termSets), ...); }, sets);
+
+    const auto &required = requiredMask<Ts...>();
+    const auto &excluded = excludedMask<Ts...>();
+
+    u32 inArchetypes = 0;
+    if (smallestSet != nullptr) {
+      forEachArchetype([&](Archetype &archetype) { inArchetypes += archetype.size(); });
+    }
+
+    // Only optional sparse set components, or few enough entities in the matching archetypes.
+    if (smallestSet == nullptr || inArchetypes <= smallestSet->size()) {
+      forEachArchetype([&](Archetype &archetype) {
+        for (u32 chunk = 0; chunk < archetype.chunks.size(); chunk++) {
+          const auto &entities = archetype.chunks[chunk].entities;
+
+          for (u32 row = 0; row < entities.size(); row++) {
+            const auto location = EntityLocation{.chunk = chunk, .row = row};
+
+            if (inRequiredSparseSets(sets, entities[row]) &&
+                passesRowFilters(sets, archetype, location, entities[row], ticks)) {
+              addView(archetype, location, entities[row], 1);
+            }
+          }
+        }
+      });
+
+      return;
+    }
+
+    for (const auto eid : *smallestSet) {
+      const auto location  = cc.entityRecords[eid.index].location;
+      auto      &archetype = cc.archetypes[location.archetype];
+
+      if (archetype.mask.containsAll(required) && !archetype.mask.intersects(excluded) &&
+          inRequiredSparseSets(sets, eid) && passesRowFilters(sets, archetype, location, eid, ticks)) {
+        addView(archetype, location, eid, 1);
       }
+    }
+  }
 
-      // The current entity doesn't have all the requested components
-      if (!iterator::allSome(unwrapTuple(iters))) {
-        continue;
+  static bool inRequiredSparseSets(const SparseSets &sets, Entity eid) {
+    auto inSet = [&]<typename T>(const TermSet<T> *set) {
+      if constexpr (isSparse<TermComponent<T>> && QueryTerm<T>::presence == Presence::Required) {
+        return set != nullptr && set->contains(eid.index);
+      } else {
+        return true;
       }
+    };
+
+    return std::apply([&](auto *...termSets) { return (inSet.template operator()<Ts>(termSets) && ...); }, sets);
+  }
 
-      return current + 1;
+  // Checks that can't be decided for a whole archetype: tick filters, and excluded sparse set components.
+  static bool passesRowFilters(
+      const SparseSets &sets, Archetype &archetype, EntityLocation location, Entity eid, SystemTicks ticks
+  ) {
+    auto passes = [&]<typename T>(const TermSet<T> *set) {
+      constexpr auto filter = QueryTerm<T>::filter;
+      using Component       = std::remove_cv_t<TermComponent<T>>;
+
+      if constexpr (isSparse<Component> && QueryTerm<T>::presence == Presence::Excluded) {
+        return set == nullptr || !set->contains(eid.index);
+      } else if constexpr (filter == TickFilter::None) {
+        return true;
+      } else if constexpr (isSparse<Component>) {
+        const auto pos = set->sparse[eid.index];
+        return isNewer(filter == TickFilter::Added ? set->added[pos] : set->changed[pos], ticks);
+      } else {
+        auto &column = archetype.template columnOf<Component>(location.chunk);
+        return isNewer(filter == TickFilter::Added ? column.added[location.row] : column.changed[location.row], ticks);
+      }
+    };
+
+    return std::apply([&](auto *...termSets) { return (passes.template operator()<Ts>(termSets) && ...); }, sets);
+  }
+
+  void addView(Archetype &archetype, EntityLocation location, Entity eid, u32 size) {
+    std::apply(
+        [&](auto *...termSets) {
+          cache->views.push_back(ChunkView{
+              .columns = Columns(componentPointer<Ts>(termSets, archetype, location, eid)...),
+              .changed = ChangedPtr{changedPointer<Ts>(termSets, archetype, location, eid)...},
+              .size    = size,
+          });
+        },
+        cache->sparseSets
+    );
+  }
+
+  // Null if the entity doesn't have the term's component. `set` is the term's entry of `SparseSets`.
+  template <typename T>
+  static TermComponent<T> *
+  componentPointer(TermSet<T> *set, Archetype &archetype, EntityLocation location, Entity eid) {
+    using Component = TermComponent<T>;
+
+    if constexpr (QueryTerm<T>::presence == Presence::Excluded) {
+      return nullptr;
+    } else if constexpr (QueryTerm<T>::presence == Presence::Always) {
+      return &archetype.chunks[location.chunk].entities[location.row];
+    } else if constexpr (isSparse<Component>) {
+      return set != nullptr && set->contains(eid.index) ? set->get(eid.index) : nullptr;
+    } else {
+      return archetype.has(componentId<Component>())
+                 ? archetype.template column<Component>(location.chunk) + location.row
+                 : nullptr;
     }
+  }
+
+  template <typename T>
+  static u32 *changedPointer(TermSet<T> *set, Archetype &archetype, EntityLocation location, Entity eid) {
+    using Component = TermComponent<T>;
 
-    return 1;
+    if constexpr (!writesComponent<T> || isTag<Component>) {
+      return nullptr;
+    } else if constexpr (isSparse<Component>) {
+      return set != nullptr && set->contains(eid.index) ? set->changed.data() + set->sparse[eid.index] : nullptr;
+    } else {
+      return archetype.has(componentId<Component>())
+                 ? archetype.template columnOf<Component>(location.chunk).changed.data() + location.row
+                 : nullptr;
+    }
   }
 
-  iterator _begin, _end;
+  SystemTicks ticks;
+  Cache       owned; // Used by queries run once
+  Cache      *cache = &owned;
+};
+
+// The one entity matching `Ts`, for queries that are known to have a single result (the player, the ball...).
+// Taken by systems instead of a `ComponentIter`, see `SystemParam<Single<Ts...>>`.
+template <typename... Ts>
+class Single {
+public:
+  Single(Entity eid, FetchTuple<Ts...> items) : eid(eid), items(items) {}
+
+  Entity entity() const { return eid; }
+
+  // Same as dereferencing an iterator of `ComponentIter<Ts...>`.
+  const FetchTuple<Ts...> &operator*() const { return items; }
 
-  iterator begin() { return _begin; }
-  iterator end() { return _end; }
+private:
+  Entity            eid;
+  FetchTuple<Ts...> items;
 };
 } // namespace ecs
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "component_id.h"
+#include "component_mask.h"
+#include "defs.h"
+#include "sparse_set.h"
+
+#include <tuple>
+#include <type_traits>
+
+namespace ecs {
+
+// Query filters, matching entities whose `T` was added / added or mutably accessed since the system last ran.
+// They don't yield the component: `Query<Pos2D, Changed<Velocity>>` iterates over `std::tuple<Pos2D &>`.
+template <typename T>
+struct Added {};
+
+template <typename T>
+struct Changed {};
+
+// Presence filters, matching entities that have / don't have a `T`. Decided per archetype for table components,
+// so non-matching entities are skipped a whole archetype at a time, without touching component data.
+template <typename T>
+struct With {};
+
+template <typename T>
+struct Without {};
+
+// Yields a `T *` that's null for matching entities without a `T`.
+template <typename T>
+struct Optional {};
+
+enum class TickFilter { None, Added, Changed };
+enum class Presence { Required, Optional, Excluded, Always };
+
+// How each term of a `Query<...>` takes part in the query.
+template <typename T>
+struct QueryTerm {
+  using Component = std::remove_reference_t<T>; // `const` if only read
+  using Item      = Component &;                // What iterating yields for this term, if it's fetched
+
+  static constexpr bool       fetch        = true;
+  static constexpr bool       accessesData = true; // Whether the system touches the component (or its ticks)
+  static constexpr Presence   presence     = Presence::Required;
+  static constexpr TickFilter filter       = TickFilter::None;
+};
+
+// Tags have no column, so there are no ticks to filter on.
+template <typename T>
+struct QueryTerm<Added<T>> : QueryTerm<const T> {
+  static_assert(!isTag<T>, "Tags don't track when they were added");
+
+  static constexpr bool       fetch  = false;
+  static constexpr TickFilter filter = TickFilter::Added;
+};
+
+template <typename T>
+struct QueryTerm<Changed<T>> : QueryTerm<const T> {
+  static_assert(!isTag<T>, "Tags don't track when they were changed");
+
+  static constexpr bool       fetch  = false;
+  static constexpr TickFilter filter = TickFilter::Changed;
+};
+
+template <typename T>
+struct QueryTerm<With<T>> : QueryTerm<const T> {
+  static constexpr bool fetch        = false;
+  static constexpr bool accessesData = false;
+};
+
+template <typename T>
+struct QueryTerm<Without<T>> : QueryTerm<const T> {
+  static constexpr bool     fetch        = false;
+  static constexpr bool     accessesData = false;
+  static constexpr Presence presence     = Presence::Excluded;
+};
+
+template <typename T>
+struct QueryTerm<Optional<T>> : QueryTerm<T> {
+  using Item = typename QueryTerm<T>::Component *;
+
+  static constexpr Presence presence = Presence::Optional;
+};
+
+// Yields the ID of each matching entity (`const Entity &`), e.g. to remove it with `Commands::removeEntity`.
+// Every entity has one, so it doesn't filter anything out, and it's read from the chunk's entity list.
+template <>
+struct QueryTerm<Entity> {
+  using Component = const Entity;
+  using Item      = Component &;
+
+  static constexpr bool       fetch        = true;
+  static constexpr bool       accessesData = false;
+  static constexpr Presence   presence     = Presence::Always;
+  static constexpr TickFilter filter       = TickFilter::None;
+};
+
+template <typename T>
+using TermComponent = typename QueryTerm<T>::Component;
+
+// Whether the term hands out mutable references, which marks the components as changed.
+template <typename T>
+constexpr bool writesComponent = QueryTerm<T>::fetch && !std::is_const_v<TermComponent<T>>;
+
+// What iterating over a query yields: an item for each fetched term.
+template <typename... Ts>
+using FetchTuple = decltype(std::tuple_cat(
+    std::declval<std::conditional_t<QueryTerm<Ts>::fetch, std::tuple<typename QueryTerm<Ts>::Item>, std::tuple<>>>(
+    )...
+));
+
+// Mask of the table components of the terms with the given presence. Computed once per query.
+template <Presence P, typename... Ts>
+const ComponentMask &presenceMask() {
+  static const ComponentMask mask = [] {
+    ComponentMask m;
+    ((QueryTerm<Ts>::presence == P && !isSparse<TermComponent<Ts>> ? m.set(componentId<TermComponent<Ts>>())
+                                                                    : void()),
+     ...);
+    return m;
+  }();
+
+  return mask;
+}
+
+// Table components an entity must have to match the query.
+template <typename... Ts>
+const ComponentMask &requiredMask() {
+  return presenceMask<Presence::Required, Ts...>();
+}
+
+// Table components an entity must not have to match the query.
+template <typename... Ts>
+const ComponentMask &excludedMask() {
+  return presenceMask<Presence::Excluded, Ts...>();
+}
+
+} // namespace ecs
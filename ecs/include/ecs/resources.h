@@ -1,14 +1,121 @@
 #pragma once
 
-#include <any>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <type_traits>
 #include <typeindex>
+#include <unordered_map>
+#include <utility>
 
 namespace ecs {
+
+// Storage of one resource type.
+// Slots are created the first time their type is looked up and live as long as their `Resources`, so handles to a
+// slot (`Res`, `ResMut`) stay valid while the resource is added, replaced or removed.
+class ResourceSlot {
+public:
+  ResourceSlot() = default;
+
+  ResourceSlot(const ResourceSlot &)            = delete;
+  ResourceSlot &operator=(const ResourceSlot &) = delete;
+
+  ~ResourceSlot() { reset(); }
+
+  bool has() const { return value != nullptr; }
+
+  template <typename R>
+  R *get() const {
+    return static_cast<R *>(value);
+  }
+
+  template <typename R, typename V>
+  void set(V &&newValue) {
+    reset();
+    value   = new R(std::forward<V>(newValue));
+    destroy = [](void *v) { delete static_cast<R *>(v); };
+  }
+
+  template <typename R>
+  std::optional<R> take() {
+    if (!has()) {
+      return {};
+    }
+
+    auto taken = std::optional<R>(std::move(*get<R>()));
+    reset();
+    return taken;
+  }
+
+  void reset() {
+    if (value != nullptr) {
+      destroy(value);
+      value = nullptr;
+    }
+  }
+
+private:
+  void *value              = nullptr;
+  void (*destroy)(void *v) = nullptr;
+};
+
+// Read only handle to a resource, see `Resources::res`. Using it is a pointer dereference, without any lookup.
+template <typename R>
+class Res {
+public:
+  explicit Res(const ResourceSlot &slot) : target(&slot) {}
+
+  // Whether the resource is currently there. The other members require it to be.
+  bool exists() const { return target->has(); }
+
+  const R &get() const { return *target->get<R>(); }
+  const R &operator*() const { return get(); }
+  const R *operator->() const { return &get(); }
+
+  const ResourceSlot &slot() const { return *target; }
+
+private:
+  const ResourceSlot *target;
+};
+
+// Mutable handle to a resource, see `Res`.
+template <typename R>
+class ResMut {
+public:
+  explicit ResMut(ResourceSlot &slot) : target(&slot) {}
+
+  bool exists() const { return target->has(); }
+
+  R &get() const { return *target->get<R>(); }
+  R &operator*() const { return get(); }
+  R *operator->() const { return &get(); }
+
+  const ResourceSlot &slot() const { return *target; }
+
+private:
+  ResourceSlot *target;
+};
+
+// A `Res` or `ResMut` system parameter that may be missing. Systems taking one run whether the resource is there or
+// not, and check it themselves.
+template <typename H>
+class Option {
+public:
+  explicit Option(H handle) : handle(handle) {}
+
+  bool exists() const { return handle.exists(); }
+  explicit operator bool() const { return exists(); }
+
+  decltype(auto) operator*() const { return *handle; }
+  auto           operator->() const { return handle.operator->(); }
+
+private:
+  H handle;
+};
+
 struct Resources {
-  std::unordered_map<std::type_index, std::any> r;
+  std::unordered_map<std::type_index, std::unique_ptr<ResourceSlot>> r;
 
   Resources() = default;
   Resources(const Resources& copy) = delete;
@@ -19,34 +126,64 @@ struct Resources {
 
   template <typename R>
   void addResource(R&& initialValue) {
-    if(r.contains(typeid(R))) {
+    auto &s = slot<std::remove_cvref_t<R>>();
+    if (s.has()) {
       std::cerr<< "Resource already exists\n";
     }
-    r.insert_or_assign(typeid(R), std::move(initialValue));
+    s.template set<std::remove_cvref_t<R>>(std::move(initialValue));
+  }
+
+  template <typename R>
+  bool contains() const {
+    auto found = r.find(typeid(R));
+    return found != r.end() && found->second->has();
   }
 
   template <typename R>
   std::optional<std::reference_wrapper<R>> getResource() {
-    if (!r.contains(typeid(R)))
+    if (!contains<R>())
       return std::nullopt;
 
-    return std::any_cast<R &>(r.find(typeid(R))->second);
+    return *r.find(typeid(R))->second->get<R>();
   }
 
   template <typename R>
   std::optional<R> consumeResource() {
-    if (!r.contains(typeid(R))) {
+    if (!contains<R>()) {
       return {};
     }
 
-    auto resIter = r.find(typeid(R));
-    auto resCopy = R(std::any_cast<R>(resIter->second));
-    r.erase(resIter);
+    return r.find(typeid(R))->second->take<R>();
+  }
 
-    return resCopy;
+  // Handles to `R`, whether it's there yet or not. Look it up once and keep the handle around.
+  template <typename R>
+  Res<R> res() {
+    return Res<R>(slot<R>());
   }
 
-  void clear() { r.clear(); }
+  template <typename R>
+  ResMut<R> resMut() {
+    return ResMut<R>(slot<R>());
+  }
+
+  // Removes every resource. The slots stay, so existing handles remain usable once resources are added back.
+  void clear() {
+    for (auto &[type, s] : r) {
+      s->reset();
+    }
+  }
+
+private:
+  template <typename R>
+  ResourceSlot &slot() {
+    auto &s = r[typeid(R)];
+    if (s == nullptr) {
+      s = std::make_unique<ResourceSlot>();
+    }
+
+    return *s;
+  }
 };
 
 struct ResourceBundle {
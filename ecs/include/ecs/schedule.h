@@ -0,0 +1,82 @@
+#pragma once
+
+#include "component_container.h"
+#include "resources.h"
+#include "system.h"
+#include "ticks.h"
+
+#include <functional>
+#include <tuple>
+#include <utility>
+
+namespace ecs {
+
+// A system known at compile time: `Fn` called with `Params`, queries and resource handles (see `SystemParam`).
+// Unlike the systems added with `Level::addPerFrameSystem`, nothing is type erased, so the call can be inlined.
+template <auto Fn, typename... Params>
+class StaticSystem {
+public:
+  explicit StaticSystem(ResourceBundle r) : states(SystemParam<Params>::init(r)...) {}
+
+  // Skipped, without advancing `lastRun`, while one of the parameters is missing.
+  void run(ComponentContainer &cc, u32 thisRun) {
+    const auto ticks = SystemTicks{.lastRun = lastRun, .thisRun = thisRun};
+
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      auto params = std::make_tuple(SystemParam<Params>::fetch(std::get<Is>(states), cc, ticks)...);
+
+      if ((std::get<Is>(params).has_value() && ...)) {
+        lastRun = ticks.thisRun;
+        std::invoke(Fn, *std::move(std::get<Is>(params))...);
+      }
+    }(std::index_sequence_for<Params...>{});
+  }
+
+  void addAccess(SystemAccess &access) const {
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      (SystemParam<Params>::addAccess(access, std::get<Is>(states)), ...);
+    }(std::index_sequence_for<Params...>{});
+  }
+
+private:
+  std::tuple<typename SystemParam<Params>::State...> states;
+  u32                                                lastRun = 0; // Change tick of the last run that wasn't skipped
+};
+
+// A fixed list of `StaticSystem`s, run one after the other in order. See `Level::addPerFrameSchedule`.
+// Meant for levels whose systems are known up front and do little work each, where calling each one through a
+// `std::function` and building its parameters costs about as much as running it.
+// Each system runs at a change tick of its own, so a system sees what the ones before it changed. The schedule uses
+// `ticks` of them from `cc.changeTick` on, and leaves advancing `changeTick` to whoever runs it (see `System::ticks`),
+// since other systems may be running alongside.
+// The schedule accesses what any of its systems does, and runs in parallel with the systems that don't conflict with
+// that.
+template <typename... Systems>
+class Schedule {
+public:
+  static constexpr u32 ticks = sizeof...(Systems);
+
+  explicit Schedule(ResourceBundle r) : systems(Systems(r)...) {}
+
+  void run(ComponentContainer &cc) {
+    auto thisRun = cc.changeTick;
+
+    std::apply(
+        [&](Systems &...system) {
+          (system.run(cc, thisRun++), ...);
+        },
+        systems
+    );
+  }
+
+  SystemAccess access() const {
+    SystemAccess access;
+    std::apply([&](const Systems &...system) { (system.addAccess(access), ...); }, systems);
+    return access;
+  }
+
+private:
+  std::tuple<Systems...> systems;
+};
+
+} // namespace ecs
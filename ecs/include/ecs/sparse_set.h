@@ -0,0 +1,106 @@
+#pragma once
+
+#include "component_mask.h"
+#include "defs.h"
+
+#include <type_traits>
+#include <vector>
+
+namespace ecs {
+
+enum class StorageType {
+  // Columns in archetype chunks. Best for components most entities have, and for fast iteration.
+  Table,
+
+  // A packed array plus an entity index. Best for components only a handful of entities have.
+  SparseSet,
+};
+
+// Specialize for a component type to change how it's stored:
+//
+//   template <>
+//   struct ecs::ComponentStorage<Boss> {
+//     static constexpr auto type = ecs::StorageType::SparseSet;
+//   };
+template <typename T>
+struct ComponentStorage {
+  static constexpr auto type = StorageType::Table;
+};
+
+template <typename T>
+constexpr bool isSparse = ComponentStorage<std::remove_cvref_t<T>>::type == StorageType::SparseSet;
+
+// Empty table components, like `struct Enemy {};`. They're only a bit in the archetype's mask and get no column.
+template <typename T>
+constexpr bool isTag = std::is_empty_v<std::remove_cvref_t<T>> && !isSparse<T>;
+
+// Mask of the components in `Ts` that are stored in archetype tables. Computed once per set of types.
+template <typename... Ts>
+const ComponentMask &tableMask() {
+  static const ComponentMask mask = [] {
+    ComponentMask m;
+    ((isSparse<Ts> ? void() : m.set(componentId<Ts>())), ...);
+    return m;
+  }();
+
+  return mask;
+}
+
+// Packed array of components and the entities that own them, plus an index from entity to position.
+// Adding and removing are O(1), iterating is O(number of components) regardless of the number of entities.
+template <typename T>
+struct SparseSet {
+  static constexpr u32 none = UINT32_MAX;
+
+  std::vector<T>      dense;
+  std::vector<Entity> entities;       // Owner of each element of `dense`
+  std::vector<u32>    added, changed; // Change ticks of each element of `dense`, see `SystemTicks`
+  std::vector<u32>    sparse;         // Entity::index -> position in `dense`, or `none`
+
+  u32 size() const { return static_cast<u32>(dense.size()); }
+
+  bool contains(u32 index) const { return index < sparse.size() && sparse[index] != none; }
+
+  T *get(u32 index) { return &dense[sparse[index]]; }
+
+  // Replacing an existing component counts as changing it.
+  template <typename U>
+  void insert(Entity eid, U &&comp, u32 tick) {
+    if (contains(eid.index)) {
+      dense[sparse[eid.index]]   = std::forward<U>(comp);
+      changed[sparse[eid.index]] = tick;
+      return;
+    }
+
+    if (eid.index >= sparse.size()) {
+      sparse.resize(eid.index + 1, none);
+    }
+
+    sparse[eid.index] = size();
+    dense.push_back(std::forward<U>(comp));
+    entities.push_back(eid);
+    added.push_back(tick);
+    changed.push_back(tick);
+  }
+
+  // Fills the hole with the last element to keep `dense` packed.
+  void remove(u32 index) {
+    const auto pos = sparse[index];
+
+    if (pos != size() - 1) {
+      dense[pos]                  = std::move(dense.back());
+      entities[pos]               = entities.back();
+      added[pos]                  = added.back();
+      changed[pos]                = changed.back();
+      sparse[entities[pos].index] = pos;
+    }
+
+    dense.pop_back();
+    entities.pop_back();
+    added.pop_back();
+    changed.pop_back();
+    sparse[index] = none;
+  }
+};
+
+} // namespace ecs
@@ -0,0 +1,390 @@
+#pragma once
+
+#include "commands.h"
+#include "component_container.h"
+#include "component_mask.h"
+#include "defs.h"
+#include "events.h"
+#include "query_terms.h"
+#include "resources.h"
+#include "thread_pool.h"
+#include "ticks.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+namespace ecs {
+
+template <typename P>
+struct SystemParam;
+
+// What a system touches, used to find out which systems can run at the same time.
+// Queried components are read if they're `const` (`Query<const Pos2D>`) or only used by a tick filter, and written
+// otherwise. Resources taken through `Res` are read, and through `ResMut` written, except `Commands` (see
+// `sharedWriteResource`).
+struct SystemAccess {
+  ComponentMask reads, writes;
+
+  // Resources are told apart by their slot, so a level resource and a global one of the same type don't conflict.
+  std::vector<const ResourceSlot *> resourceReads, resourceWrites;
+
+  // Systems taking a `ResourceBundle` can reach any resource, so they're assumed to conflict with every other
+  // system and always run alone, on the thread running the level.
+  bool exclusive = false;
+
+  bool conflictsWith(const SystemAccess &other) const {
+    return exclusive || other.exclusive || writes.intersects(other.reads) || writes.intersects(other.writes) ||
+           reads.intersects(other.writes) || shareAny(resourceWrites, other.resourceReads) ||
+           shareAny(resourceWrites, other.resourceWrites) || shareAny(resourceReads, other.resourceWrites);
+  }
+
+  template <typename... Ts>
+  void addQuery(std::type_identity<Query<Ts...>> /*DUMMY*/) {
+    (addTerm<Ts>(), ...);
+  }
+
+  // `With`/`Without` only look at which components entities have, which can't change while systems run.
+  template <typename T>
+  void addTerm() {
+    if constexpr (writesComponent<T>) {
+      writes.set(componentId<TermComponent<T>>());
+    } else if constexpr (QueryTerm<T>::accessesData) {
+      reads.set(componentId<TermComponent<T>>());
+    }
+  }
+
+  // `states` are the ones the parameters were resolved to, see `SystemParam::init`.
+  template <typename... Params>
+  static SystemAccess of(bool exclusive, const std::tuple<typename SystemParam<Params>::State...> &states = {});
+
+private:
+  // Systems use a handful of resources at most.
+  static bool shareAny(const std::vector<const ResourceSlot *> &a, const std::vector<const ResourceSlot *> &b) {
+    return std::ranges::any_of(a, [&](const ResourceSlot *slot) { return std::ranges::find(b, slot) != b.end(); });
+  }
+};
+
+// How a system parameter is obtained. `init` resolves what can be resolved once, when the system is added, and
+// `fetch` gets the parameter before each run, or nothing if the system can't run.
+
+// Each system keeps the archetypes its queries matched and the views built over them, so running a query only looks
+// at the archetypes created and the rows added or removed since the last run.
+template <typename... Ts>
+struct SystemParam<Query<Ts...>> {
+  using State = typename MultiIterator<Ts...>::Cache;
+
+  static State init(ResourceBundle /*DUMMY*/) { return {}; }
+
+  static std::optional<MultiIterator<Ts...>> fetch(State &cache, ComponentContainer &cc, SystemTicks ticks) {
+    return cc.getQueryIter(Query<Ts...>{}, cache, ticks);
+  }
+
+  static void addAccess(SystemAccess &access, const State & /*DUMMY*/) {
+    access.addQuery(std::type_identity<Query<Ts...>>{});
+  }
+};
+
+// Remembers the entity it found, and only looks for it again among the query's archetypes once it stops matching.
+// The system is skipped while no entity matches. Debug builds check that there's only one.
+template <typename... Ts>
+struct SystemParam<Single<Ts...>> {
+  struct State {
+    ArchetypeMatches matches;
+    Entity           entity;
+  };
+
+  static State init(ResourceBundle /*DUMMY*/) { return {}; }
+
+  static std::optional<Single<Ts...>> fetch(State &state, ComponentContainer &cc, SystemTicks ticks) {
+    if (!cc.queryComponentsExist<Ts...>()) {
+      std::cerr << "Attempt to run a system with no available components (" << typeid(std::tuple<Ts...>).name()
+                << ").\n";
+      return std::nullopt;
+    }
+
+    const auto sets = MultiIterator<Ts...>::findSparseSets(cc);
+    if (!MultiIterator<Ts...>::matchesEntity(cc, sets, state.entity, ticks)) {
+      state.entity = Entity{};
+      forEachMatch(state, cc, sets, ticks, [&](Entity eid) {
+        state.entity = eid;
+        return false;
+      });
+
+      if (state.entity == Entity{}) {
+        return std::nullopt;
+      }
+    }
+
+#ifdef DEBUG
+    assert(countMatches(state, cc, sets, ticks) == 1 && "More than one entity matches a `Single` query");
+#endif
+
+    return Single<Ts...>(state.entity, MultiIterator<Ts...>::fetchEntity(cc, sets, state.entity, ticks));
+  }
+
+  static void addAccess(SystemAccess &access, const State & /*DUMMY*/) {
+    access.addQuery(std::type_identity<Query<Ts...>>{});
+  }
+
+private:
+  using SparseSets = typename MultiIterator<Ts...>::SparseSets;
+
+  // Calls `fn(eid)` on the entities matching the query until it returns false.
+  template <typename F>
+  static void forEachMatch(State &state, ComponentContainer &cc, const SparseSets &sets, SystemTicks ticks, F &&fn) {
+    cc.updateMatches(state.matches, requiredMask<Ts...>(), excludedMask<Ts...>());
+
+    for (const auto archetype : state.matches.archetypes) {
+      for (const auto &chunk : cc.archetypes[archetype].chunks) {
+        for (const auto eid : chunk.entities) {
+          if (MultiIterator<Ts...>::matchesEntity(cc, sets, eid, ticks) && !fn(eid)) {
+            return;
+          }
+        }
+      }
+    }
+  }
+
+  [[maybe_unused]] static u32
+  countMatches(State &state, ComponentContainer &cc, const SparseSets &sets, SystemTicks ticks) {
+    u32 count = 0;
+    forEachMatch(state, cc, sets, ticks, [&](Entity /*DUMMY*/) {
+      count++;
+      return true;
+    });
+    return count;
+  }
+};
+
+// Resources are meant to be added before the systems using them, missing ones are reported.
+template <typename R>
+void checkResourceExists(ResourceBundle r) {
+  if (!r.level.contains<R>() && !r.global.contains<R>()) {
+    std::cerr << "Attempt to add a system using a resource that doesn't exist (" << typeid(R).name() << ")\n";
+  }
+}
+
+// Resources that systems running at the same time can all write to. `Commands` records into one buffer per thread
+// and is only applied once the level's systems ran, so systems that spawn entities don't conflict over it.
+template <typename R>
+inline constexpr bool sharedWriteResource = std::is_same_v<R, Commands>;
+
+// A resource handle (`Res`, `ResMut`) taken by a system. When the system is added, it's bound to the level's resource
+// if there is one, else to the global one. If neither exists yet, it's bound on the first run that finds the resource
+// in either, and until then `global` holds the global slot.
+template <typename H>
+struct BoundHandle {
+  H                handle;
+  std::optional<H> global;
+
+  // `handleIn(resources)` gets the handle to the resource in `resources`.
+  template <typename R, typename F>
+  static BoundHandle resolve(ResourceBundle r, F &&handleIn) {
+    if (r.level.contains<R>() || !r.global.contains<R>()) {
+      return BoundHandle{
+          .handle = handleIn(r.level),
+          .global = r.level.contains<R>() ? std::nullopt : std::optional(handleIn(r.global)),
+      };
+    }
+
+    return BoundHandle{.handle = handleIn(r.global), .global = std::nullopt};
+  }
+
+  // The handle, or nothing while the resource is missing.
+  std::optional<H> bind() {
+    if (global.has_value()) {
+      if (!handle.exists() && global->exists()) {
+        handle = *global;
+      }
+      if (!handle.exists()) {
+        return std::nullopt;
+      }
+      global.reset();
+    }
+
+    return handle.exists() ? std::optional(handle) : std::nullopt;
+  }
+
+  // While unbound, both slots the resource could end up in.
+  void addSlots(std::vector<const ResourceSlot *> &slots) const {
+    slots.push_back(&handle.slot());
+    if (global.has_value()) {
+      slots.push_back(&global->slot());
+    }
+  }
+};
+
+// The system is skipped while the resource is missing.
+template <typename R>
+struct SystemParam<Res<R>> {
+  using State = BoundHandle<Res<R>>;
+
+  static State init(ResourceBundle r) {
+    checkResourceExists<R>(r);
+    return resolve(r);
+  }
+
+  static State resolve(ResourceBundle r) {
+    return State::template resolve<R>(r, [](Resources &resources) { return resources.res<R>(); });
+  }
+
+  static std::optional<Res<R>> fetch(State &state, ComponentContainer & /*DUMMY*/, SystemTicks /*DUMMY*/) {
+    return state.bind();
+  }
+
+  static void addAccess(SystemAccess &access, const State &state) { state.addSlots(access.resourceReads); }
+};
+
+template <typename R>
+struct SystemParam<ResMut<R>> {
+  using State = BoundHandle<ResMut<R>>;
+
+  static State init(ResourceBundle r) {
+    checkResourceExists<R>(r);
+    return resolve(r);
+  }
+
+  static State resolve(ResourceBundle r) {
+    return State::template resolve<R>(r, [](Resources &resources) { return resources.resMut<R>(); });
+  }
+
+  static std::optional<ResMut<R>> fetch(State &state, ComponentContainer & /*DUMMY*/, SystemTicks /*DUMMY*/) {
+    return state.bind();
+  }
+
+  static void addAccess(SystemAccess &access, const State &state) {
+    if constexpr (!sharedWriteResource<R>) {
+      state.addSlots(access.resourceWrites);
+    }
+  }
+};
+
+// Never skips the system, and doesn't need the resource to exist when the system is added.
+template <typename H>
+struct SystemParam<Option<H>> {
+  using State = typename SystemParam<H>::State;
+
+  static State init(ResourceBundle r) { return SystemParam<H>::resolve(r); }
+
+  static std::optional<Option<H>> fetch(State &state, ComponentContainer & /*DUMMY*/, SystemTicks /*DUMMY*/) {
+    state.bind();
+    return Option<H>(state.handle);
+  }
+
+  static void addAccess(SystemAccess &access, const State &state) { SystemParam<H>::addAccess(access, state); }
+};
+
+// Reads the channel like a `Res<Events<T>>`, and is skipped the same way while it's missing.
+template <typename T>
+struct SystemParam<EventReader<T>> {
+  struct State {
+    EventCursor<T>                              cursor;
+    typename SystemParam<Res<Events<T>>>::State events;
+  };
+
+  static State init(ResourceBundle r) { return State{.cursor = {}, .events = SystemParam<Res<Events<T>>>::init(r)}; }
+
+  static std::optional<EventReader<T>> fetch(State &state, ComponentContainer & /*DUMMY*/, SystemTicks /*DUMMY*/) {
+    const auto events = state.events.bind();
+    return events.has_value() ? std::optional(EventReader<T>(state.cursor, **events)) : std::nullopt;
+  }
+
+  static void addAccess(SystemAccess &access, const State &state) {
+    SystemParam<Res<Events<T>>>::addAccess(access, state.events);
+  }
+};
+
+template <typename... Params>
+SystemAccess SystemAccess::of(bool exclusive, const std::tuple<typename SystemParam<Params>::State...> &states) {
+  SystemAccess access;
+  access.exclusive = exclusive;
+
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (SystemParam<Params>::addAccess(access, std::get<Is>(states)), ...);
+  }(std::index_sequence_for<Params...>{});
+
+  return access;
+}
+
+struct System {
+  std::function<void()> run;
+  SystemAccess          access;
+  u32                   ticks = 1; // Change ticks a run uses, from the current one on (more than one for a `Schedule`)
+};
+
+// Runs a list of systems, overlapping the ones that don't conflict.
+// Each system depends on every earlier system it conflicts with, so conflicting systems keep their insertion order.
+// Systems are grouped into stages: a system's stage is one past the latest stage of its dependencies, and the systems
+// of a stage run in parallel on the global thread pool.
+// `changeTick` advances before each stage, and past the extra ticks a system of the stage used after it. Systems of the
+// same stage never write what another one reads, so they can share a tick.
+struct SystemStages {
+  std::vector<std::vector<u32>> stages; // Indices into the system list
+  u32                           builtFor = 0;
+
+  void run(std::vector<System> &systems, u32 &changeTick) {
+    if (builtFor != systems.size()) {
+      build(systems);
+    }
+
+    for (const auto &stage : stages) {
+      changeTick++;
+
+      u32 ticks = 1;
+      for (const auto index : stage) {
+        ticks = std::max(ticks, systems[index].ticks);
+      }
+
+      if (stage.size() == 1) {
+        runSystem(systems, stage[0]);
+      } else {
+        ThreadPool::global().parallelFor(stage.size(), 1, [&](u32 begin, u32 end) {
+          for (u32 i = begin; i < end; i++) {
+            runSystem(systems, stage[i]);
+          }
+        });
+      }
+
+      changeTick += ticks - 1;
+    }
+  }
+
+private:
+  // Systems are keyed by their position in the list, so that their commands are applied in that order whichever
+  // thread ran them. 0 is left for work done outside of systems.
+  static void runSystem(std::vector<System> &systems, u32 index) {
+    ThreadPool::orderKey() = index + 1;
+    systems[index].run();
+    ThreadPool::orderKey() = 0;
+  }
+
+  void build(const std::vector<System> &systems) {
+    stages.clear();
+
+    std::vector<u32> stageOf(systems.size(), 0);
+
+    for (u32 i = 0; i < systems.size(); i++) {
+      for (u32 dep = 0; dep < i; dep++) {
+        if (systems[i].access.conflictsWith(systems[dep].access)) {
+          stageOf[i] = std::max(stageOf[i], stageOf[dep] + 1);
+        }
+      }
+
+      if (stageOf[i] >= stages.size()) {
+        stages.resize(stageOf[i] + 1);
+      }
+      stages[stageOf[i]].push_back(i);
+    }
+
+    builtFor = systems.size();
+  }
+};
+
+} // namespace ecs
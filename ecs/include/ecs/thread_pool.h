@@ -0,0 +1,255 @@
+#pragma once
+
+#include "defs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+
+// Work-stealing thread pool.
+// Every worker has its own task queue: it takes pieces from the back of its own queue and, once that's empty, steals
+// from the front of the others'. The thread calling `parallelFor` runs pieces of it from its own queue too, and only
+// sleeps once the rest has been taken by other threads. It never waits on a piece that isn't running, so nested
+// `parallelFor`s can't deadlock.
+class ThreadPool {
+  // One `parallelFor` call, shared by all of its pieces.
+  struct Job {
+    std::function<void(u32, u32)> fn;
+    u32                           count;
+    u32                           grainSize;
+    u32                           orderKey;
+    std::atomic<u32>              remaining; // Pieces not done yet
+
+    std::mutex              mutex;
+    std::condition_variable done;
+    bool                    finished = false;
+  };
+
+  // Pieces [begin, end) of a job, taken one at a time from either end.
+  struct Task {
+    Job *job;
+    u32  begin;
+    u32  end;
+  };
+
+  struct TaskQueue {
+    std::mutex       mutex;
+    std::deque<Task> tasks;
+  };
+
+public:
+  // The calling thread helps out, so one less worker than there are cores.
+  explicit ThreadPool(u32 workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1) {
+    // One queue per worker, the last one is shared by all threads outside the pool.
+    for (u32 i = 0; i <= workerCount; i++) {
+      queues.push_back(std::make_unique<TaskQueue>());
+    }
+
+    for (u32 i = 0; i < workerCount; i++) {
+      workers.emplace_back([this, i](std::stop_token stop) { workerLoop(i, stop); });
+    }
+  }
+
+  ~ThreadPool() {
+    for (auto &worker : workers) {
+      worker.request_stop();
+    }
+
+    {
+      std::lock_guard lock(sleepMutex);
+      wake.notify_all();
+    }
+
+    // Join before the members the workers use are destroyed.
+    workers.clear();
+  }
+
+  ThreadPool(const ThreadPool &)            = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Shared by all levels.
+  static ThreadPool &global() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  u32 workerCount() const { return workers.size(); }
+
+  // Index of the calling thread among the `threadCount()` threads that run the pool's tasks: its workers, then every
+  // thread outside the pool, which share the last index.
+  u32 threadIndex() const { return currentQueue(); }
+  u32 threadCount() const { return queues.size(); }
+
+  // Where the work running on this thread stands in an order defined by whoever runs it. Levels set it to the running
+  // system (see `Commands`). The tasks of a `parallelFor` run with the key of the thread that started it.
+  static u32 &orderKey() { return currentOrderKey; }
+
+  // Calls `fn(begin, end)` on pieces of at most `grainSize` indices covering [0, count), and returns once all pieces
+  // are done. Pieces run concurrently, in no particular order.
+  template <typename F>
+  void parallelFor(u32 count, u32 grainSize, F &&fn) {
+    grainSize = std::max(grainSize, 1u);
+
+    if (workers.empty() || count <= grainSize) {
+      if (count > 0) {
+        fn(0u, count);
+      }
+      return;
+    }
+
+    const auto pieces = (count + grainSize - 1) / grainSize;
+    const auto self   = currentQueue();
+
+    Job job{
+        .fn        = [&fn](u32 begin, u32 end) { fn(begin, end); },
+        .count     = count,
+        .grainSize = grainSize,
+        .orderKey  = orderKey(),
+        .remaining = pieces,
+    };
+
+    pending.fetch_add(pieces, std::memory_order_release);
+    {
+      auto           &queue = *queues[self];
+      std::lock_guard lock(queue.mutex);
+      queue.tasks.push_back(Task{.job = &job, .begin = 0, .end = pieces});
+    }
+
+    {
+      std::lock_guard lock(sleepMutex);
+      wake.notify_all();
+    }
+
+    // Pieces of other jobs pushed on this queue are left to the threads waiting on them.
+    while (runOwnPiece(self, job)) {
+    }
+
+    std::unique_lock lock(job.mutex);
+    job.done.wait(lock, [&] { return job.finished; });
+  }
+
+private:
+  u32 currentQueue() const { return workerPool == this ? workerIndex : workers.size(); }
+
+  // Runs the last piece left of `job` in queue `self`. Returns false if other threads took them all.
+  bool runOwnPiece(u32 self, Job &job) {
+    u32 piece;
+
+    {
+      auto           &own = *queues[self];
+      std::lock_guard lock(own.mutex);
+
+      const auto task =
+          std::find_if(own.tasks.rbegin(), own.tasks.rend(), [&](const Task &task) { return task.job == &job; });
+      if (task == own.tasks.rend()) {
+        return false;
+      }
+
+      piece = --task->end;
+      if (task->begin == task->end) {
+        own.tasks.erase(std::next(task).base());
+      }
+    }
+
+    runPiece(job, piece);
+    return true;
+  }
+
+  // Runs the last piece of the task at the back of queue `self`, or the first piece of the task at the front of
+  // another queue. Returns false if there was nothing to run.
+  bool runTask(u32 self) {
+    Job *job = nullptr;
+    u32  piece;
+
+    {
+      auto           &own = *queues[self];
+      std::lock_guard lock(own.mutex);
+
+      if (!own.tasks.empty()) {
+        auto &task = own.tasks.back();
+        job        = task.job;
+        piece      = --task.end;
+
+        if (task.begin == task.end) {
+          own.tasks.pop_back();
+        }
+      }
+    }
+
+    for (u32 i = 1; job == nullptr && i < queues.size(); i++) {
+      auto           &victim = *queues[(self + i) % queues.size()];
+      std::lock_guard lock(victim.mutex);
+
+      if (!victim.tasks.empty()) {
+        auto &task = victim.tasks.front();
+        job        = task.job;
+        piece      = task.begin++;
+
+        if (task.begin == task.end) {
+          victim.tasks.pop_front();
+        }
+      }
+    }
+
+    if (job == nullptr) {
+      return false;
+    }
+
+    runPiece(*job, piece);
+    return true;
+  }
+
+  // `job` may be gone as soon as its last piece is marked done.
+  void runPiece(Job &job, u32 piece) {
+    pending.fetch_sub(1, std::memory_order_relaxed);
+
+    const auto begin    = piece * job.grainSize;
+    const auto outerKey = std::exchange(currentOrderKey, job.orderKey);
+    job.fn(begin, std::min(begin + job.grainSize, job.count));
+    currentOrderKey = outerKey;
+
+    if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard lock(job.mutex);
+      job.finished = true;
+      job.done.notify_all();
+    }
+  }
+
+  void workerLoop(u32 index, std::stop_token stop) {
+    workerPool  = this;
+    workerIndex = index;
+
+    while (!stop.stop_requested()) {
+      if (runTask(index)) {
+        continue;
+      }
+
+      std::unique_lock lock(sleepMutex);
+      wake.wait(lock, [&] { return stop.stop_requested() || pending.load(std::memory_order_acquire) > 0; });
+    }
+  }
+
+  // The pool and worker index of the worker running on this thread, if any.
+  static inline thread_local const ThreadPool *workerPool  = nullptr;
+  static inline thread_local u32               workerIndex = 0;
+
+  static inline thread_local u32 currentOrderKey = 0;
+
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  std::vector<std::jthread>               workers;
+
+  std::atomic<u32>        pending = 0; // Tasks queued but not started yet
+  std::mutex              sleepMutex;
+  std::condition_variable wake;
+};
+
+} // namespace ecs
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "defs.h"
+
+namespace ecs {
+
+// Change detection.
+// The container's change tick advances before each stage of systems and before commands are applied. Components
+// remember the tick they were added at and the tick they were last mutably accessed at, and each system remembers
+// the tick of its previous run, so it can tell which components are new to it.
+struct SystemTicks {
+  u32 lastRun = 0; // 0 before the first run, so everything counts as new
+  u32 thisRun = 0;
+};
+
+// Whether `tick` happened after the system's previous run.
+// Ticks are compared relative to `thisRun` so they keep working once the counter wraps around, as long as no
+// system goes 2^31 ticks without running.
+inline bool isNewer(u32 tick, SystemTicks ticks) { return ticks.thisRun - tick < ticks.thisRun - ticks.lastRun; }
+
+} // namespace ecs
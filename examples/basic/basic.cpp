@@ -27,10 +27,10 @@ struct Player {
 
 struct Enemy {};
 
-void checkGoalMet(ecs::ResourceBundle r, ecs::ComponentIter<Enemy, Health> enemies) {
+void checkGoalMet(ecs::ResourceBundle r, ecs::ComponentIter<ecs::With<Enemy>, const Health> enemies) {
   auto deadEnemies = 0;
-  for (const auto &[_, eHealth] : enemies) {
-    if (eHealth->value == 0) {
+  for (const auto &[eHealth] : enemies) {
+    if (eHealth.value == 0) {
       deadEnemies += 1;
     }
   }
@@ -45,25 +45,28 @@ void checkGoalMet(ecs::ResourceBundle r, ecs::ComponentIter<Enemy, Health> enemi
   }
 }
 
-void printEnemies(ecs::ComponentIter<Enemy, Health, Pos2D> enemies) {
-  for (const auto &[_, health, pos] : enemies) {
-    std::cout << "Enemy at position: (" << pos->x << ',' << pos->y << "), health: " << health->value << '\n';
+void printEnemies(ecs::ComponentIter<ecs::With<Enemy>, const Health, const Pos2D> enemies) {
+  for (const auto &[health, pos] : enemies) {
+    std::cout << "Enemy at position: (" << pos.x << ',' << pos.y << "), health: " << health.value << '\n';
   }
 
   std::cout << '\n';
 }
 
-void damageEnemies(ecs::ComponentIter<Player, Pos2D> player, ecs::ComponentIter<Enemy, Health, Pos2D> enemies) {
-  auto [playerComp, playerPos] = *player.begin();
+void damageEnemies(
+    ecs::Single<const Player, const Pos2D>                    player,
+    ecs::ComponentIter<ecs::With<Enemy>, Health, const Pos2D> enemies
+) {
+  auto [playerComp, playerPos] = *player;
 
-  for (const auto &[_, eHealth, ePos] : enemies) {
-    const auto dx   = playerPos->x - ePos->x;
-    const auto dy   = playerPos->y - ePos->y;
+  for (const auto &[eHealth, ePos] : enemies) {
+    const auto dx   = playerPos.x - ePos.x;
+    const auto dy   = playerPos.y - ePos.y;
     const auto dist = std::sqrt(dx * dx + dy * dy);
 
-    if (dist < playerComp->range) {
-      auto damage    = playerComp->damage / dist;
-      eHealth->value = std::max<u32>(eHealth->value - damage, 0u);
+    if (dist < playerComp.range) {
+      auto damage   = playerComp.damage / dist;
+      eHealth.value = std::max<u32>(eHealth.value - damage, 0u);
     }
   }
 }
@@ -75,16 +78,23 @@ void setupExampleLevel(ecs::Resources &global, ecs::Level &el) {
   el.addEntity(Player{.damage = 23, .range = 10}, Pos2D{1, -6});
 
   const std::vector<Pos2D> enemyPositions = {{1, 1}, {0, 12}, {-2, 0}, {2, 2}, {0, 0}};
-  for (const auto &ePos : enemyPositions) {
-    el.addEntity(Enemy{}, Health{100}, Pos2D{ePos});
-  }
+  el.addEntities(enemyPositions.size(), [&](u32 i) {
+    return std::make_tuple(Enemy{}, Health{100}, enemyPositions[i]);
+  });
 
   // Notice that that template signature and the function signature should match
-  // ecs::Query<Ts...> becomes ecs::ComponentIter<Ts...>
-  // Note that systems are run in the order they're added in.
-  el.addPerFrameSystem<ecs::Query<Player, Pos2D>, ecs::Query<Enemy, Health, Pos2D>>(damageEnemies);
-  el.addPerFrameSystem<ecs::Query<Enemy, Health, Pos2D>>(printEnemies);
-  el.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Enemy, Health>>(checkGoalMet);
+  // ecs::Query<Ts...> becomes ecs::ComponentIter<Ts...>, ecs::Single<Ts...> (exactly one entity matches) stays the same
+  // Systems known up front can be added as one schedule, run in order and without any indirection.
+  el.addPerFrameSchedule<
+      ecs::StaticSystem<
+          damageEnemies,
+          ecs::Single<const Player, const Pos2D>,
+          ecs::Query<ecs::With<Enemy>, Health, const Pos2D>>,
+      ecs::StaticSystem<printEnemies, ecs::Query<ecs::With<Enemy>, const Health, const Pos2D>>>();
+
+  // Components a system only reads should be `const`. Systems that don't write to what others access can run in
+  // parallel, the rest run in the order they're added in.
+  el.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<ecs::With<Enemy>, const Health>>(checkGoalMet);
 }
 
 int main() {
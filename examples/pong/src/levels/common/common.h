@@ -101,14 +101,14 @@ struct Text {
 };
 
 struct TextAnimation {
-  std::function<void(ecs::ResourceBundle, ecs::Iter<Text>, float)> animate;
-  float                                                            animationSpeed;
+  std::function<void(ecs::ResourceBundle, Text &, float)> animate;
+  float                                                   animationSpeed;
 };
 
-void sinAnimation(ecs::ResourceBundle r, ecs::Iter<Text> t, float animationSpeed) {
-  auto &time   = r.global.getResource<Time>()->get();
-  auto &dt = r.global.getResource<DeltaTime>()->get();
-  t->fontScale = (std::sin(time * animationSpeed * dt)) / 4 + 0.75;
+void sinAnimation(ecs::ResourceBundle r, Text &t, float animationSpeed) {
+  auto &time  = r.global.getResource<Time>()->get();
+  auto &dt    = r.global.getResource<DeltaTime>()->get();
+  t.fontScale = (std::sin(time * animationSpeed * dt)) / 4 + 0.75;
 }
 
 struct CenterText {};
@@ -178,11 +178,11 @@ struct MenuScreen {
   void reset() { selectedOption = 0; }
 };
 
-void renderMenuTitle(ecs::ResourceBundle r, ecs::ComponentIter<Text, TextAnimation, CenterText> iter) {
+void renderMenuTitle(ecs::ResourceBundle r, ecs::ComponentIter<Text, TextAnimation, ecs::With<CenterText>> iter) {
   auto &renderer = r.global.getResource<Renderer>()->get();
-  for (auto &[t, ta, tc] : iter) {
-    ta->animate(r, t, ta->animationSpeed);
-    renderer.drawText(t->drawCenterAligned());
+  for (auto [t, ta] : iter) {
+    ta.animate(r, t, ta.animationSpeed);
+    renderer.drawText(t.drawCenterAligned());
   }
 }
 
@@ -26,13 +26,6 @@ struct Round : Wrapper<uint> {};
 
 struct PlayerScored {
   Player scoringPlayer;
-  bool   operator==(const PlayerScored &rhs) const = default;
-
-  struct Hasher {
-    std::size_t operator()(const pong::PlayerScored &be) const noexcept {
-      return static_cast<std::size_t>(be.scoringPlayer);
-    }
-  };
 };
 
 struct PauseScreen : MenuScreen {
@@ -76,41 +69,52 @@ struct PlayerScore {
     updateText();
   }
 };
+} // namespace pong
+
+// Only the two paddles have these, no need to give them a column in every archetype chunk.
+template <>
+struct ecs::ComponentStorage<pong::Player> {
+  static constexpr auto type = ecs::StorageType::SparseSet;
+};
+
+template <>
+struct ecs::ComponentStorage<pong::PlayerScore> {
+  static constexpr auto type = ecs::StorageType::SparseSet;
+};
 
+namespace pong {
 f32 sign(float x) { return x > 0 ? 1 : -1; }
 f32 frac(float x) { return x - static_cast<int>(x); }
 
 void render(
-    ecs::ResourceBundle                      r,
-    ecs::ComponentIter<Pos2D, Rect, Color>   pIter,
-    ecs::ComponentIter<Pos2D, Circle, Color> bIter,
-    ecs::ComponentIter<PlayerScore>          sIter
+    ecs::ResMut<Renderer>                                      renderer,
+    ecs::ComponentIter<const Pos2D, const Rect, const Color>   pIter,
+    ecs::ComponentIter<const Pos2D, const Circle, const Color> bIter,
+    ecs::ComponentIter<const PlayerScore>                      sIter
 ) {
-  auto &renderer = r.global.getResource<Renderer>()->get();
-
   for (const auto &[p, r, c] : pIter) {
-    renderer.drawRect(p->x, p->y, r->width, r->height, *c);
+    renderer->drawRect(p.x, p.y, r.width, r.height, c);
   }
 
   for (const auto &[p, s, c] : bIter) {
-    renderer.drawCircle(p->x, p->y, s->radius, *c);
+    renderer->drawCircle(p.x, p.y, s.radius, c);
   }
 
-  for (auto &[ps] : sIter) {
-    renderer.drawText(ps->text.drawCenterAligned());
+  for (auto [ps] : sIter) {
+    renderer->drawText(ps.text.drawCenterAligned());
   }
+};
 
+// The menu's options act on any resource, so this one takes the whole bundle.
+void updatePauseMenu(ecs::ResourceBundle r) {
   const auto paused = r.level.getResource<Paused>()->get();
   if (paused) {
     auto &pauseMenu = r.level.getResource<PauseScreen>()->get();
     pauseMenu.update(r);
   }
-};
-
-void moveAI(ecs::ResourceBundle r, Pos2D &pos, Pos2D &ballPosition, Velocity &vel) {
-  const auto time   = r.global.getResource<Time>()->get();
-  const auto aiDiff = r.global.getResource<AIDifficulty>()->get();
+}
 
+void moveAI(f32 time, AIDifficulty aiDiff, Pos2D &pos, Pos2D &ballPosition, Velocity &vel) {
   auto slowness = 0.2;
   auto speed    = 0.75;
 
@@ -147,71 +151,77 @@ void moveAI(ecs::ResourceBundle r, Pos2D &pos, Pos2D &ballPosition, Velocity &ve
 }
 
 void handleInputs(
-    ecs::ResourceBundle r, ecs::ComponentIter<Player, Pos2D, Velocity> iter, ecs::ComponentIter<Circle, Pos2D> ball
+    ecs::Res<Input>                             inputs,
+    ecs::Res<ScreenWidth>                       screenWidth,
+    ecs::Res<Time>                              time,
+    ecs::Option<ecs::Res<AIDifficulty>>         aiDifficulty,
+    ecs::ResMut<Paused>                         paused,
+    ecs::ComponentIter<Player, Pos2D, Velocity> iter,
+    ecs::Single<Circle, Pos2D>                  ball
 ) {
 
-  const auto &inputs = r.global.getResource<Input>()->get();
-  const auto  sh     = r.global.getResource<ScreenWidth>()->get();
+  const auto sh     = *screenWidth;
+  const auto aiDiff = aiDifficulty ? *aiDifficulty : AIDifficulty::Medium;
 
-  auto [_, ballPosition] = *ball.begin();
+  auto [_, ballPosition] = *ball;
 
-  for (auto &[pl, pos, vel] : iter) {
-    if (std::fabs(vel->y) > 0) {
-      vel->y *= 0.90;
+  for (auto [pl, pos, vel] : iter) {
+    if (std::fabs(vel.y) > 0) {
+      vel.y *= 0.90;
     }
 
-    switch (*pl) {
+    switch (pl) {
     case Player::Human: {
 
-      if (inputs.isKeyDown(KEY_W) && pos->y > 0) {
-        vel->y = -playerMovementSpeed;
+      if (inputs->isKeyDown(KEY_W) && pos.y > 0) {
+        vel.y = -playerMovementSpeed;
       }
 
-      if (inputs.isKeyDown(KEY_S) && pos->y < (sh - paddleHeight)) {
-        vel->y = playerMovementSpeed;
+      if (inputs->isKeyDown(KEY_S) && pos.y < (sh - paddleHeight)) {
+        vel.y = playerMovementSpeed;
       }
 
       break;
     }
     case Player::AI: {
-      moveAI(r, *pos, *ballPosition, *vel);
+      moveAI(*time, aiDiff, pos, ballPosition, vel);
       break;
     }
     }
   }
 
-  if (inputs.wasKeyPressed(KEY_ESCAPE)) {
-    auto &paused = r.level.getResource<Paused>()->get();
-    paused       = Paused(!paused);
+  if (inputs->wasKeyPressed(KEY_ESCAPE)) {
+    *paused = Paused(!*paused);
   }
 }
 
-void moveObjects(ecs::ResourceBundle r, ecs::ComponentIter<Pos2D, Velocity> iter) {
-  const auto paused = r.level.getResource<Paused>()->get();
-
-  if (paused) {
+void moveObjects(ecs::Res<Paused> paused, ecs::Res<DeltaTime> deltaTime, ecs::ComponentIter<Pos2D, Velocity> iter) {
+  if (*paused) {
     return;
   }
 
-  const auto dt = r.global.getResource<DeltaTime>()->get();
+  const auto dt = *deltaTime;
 
-  for (auto &[pos, vel] : iter) {
-    pos->x += vel->x * dt;
-    pos->y += vel->y * dt;
+  for (auto [pos, vel] : iter.chunks()) {
+    for (std::size_t i = 0; i < pos.size(); i++) {
+      pos[i].x += vel[i].x * dt;
+      pos[i].y += vel[i].y * dt;
+    }
   }
 }
 
-void checkGoal(ecs::ResourceBundle r, ecs::ComponentIter<Circle, Pos2D, Velocity> iter) {
-  const auto sw = r.global.getResource<ScreenWidth>()->get();
-  const auto sh = r.global.getResource<ScreenHeight>()->get();
-
-  auto &round = r.level.getResource<Round>()->get();
+void checkGoal(
+    ecs::Res<ScreenWidth>                         screenWidth,
+    ecs::ResMut<ecs::Events<PlayerScored>>        scored,
+    ecs::ComponentIter<const Circle, const Pos2D> iter
+) {
+  const auto sw = *screenWidth;
 
-  for (auto &[c, p, v] : iter) {
+  for (auto [c, p] : iter) {
     std::optional<Player> scoring = std::nullopt;
 
-    const auto rightGoal = p->x > (sw - c->radius);
-    const auto leftGoal  = p->x < c->radius;
+    const auto rightGoal = p.x > (sw - c.radius);
+    const auto leftGoal  = p.x < c.radius;
 
     if (rightGoal) {
       scoring = Player::AI;
@@ -220,46 +230,53 @@ void checkGoal(ecs::ResourceBundle r, ecs::ComponentIter<Circle, Pos2D, Velocity
     }
 
     if (scoring) {
-      r.level.addResource(PlayerScored{*scoring});
-      p->x = sw / 2;
-      p->y = sh / 2;
-      round += 1;
-
-      // Flip the ball's direction every round
-      if (round % 2 == 0) {
-        *v = {ballSpeed, 0};
-      } else {
-        *v = {-ballSpeed, 0};
-      }
+      scored->send(PlayerScored{*scoring});
     }
   }
 }
 
-void onGoal(ecs::ResourceBundle r, ecs::ComponentIter<Pos2D, Player, PlayerScore> iter) {
-  auto be = r.level.consumeResource<PlayerScored>();
+void onGoal(
+    ecs::ResourceBundle                            r,
+    ecs::EventReader<PlayerScored>                 scored,
+    ecs::ComponentIter<Pos2D, Player, PlayerScore> iter,
+    ecs::Single<const Circle, Pos2D, Velocity>     ball
+) {
+  for (const auto &goal : scored.read()) {
+    const auto sw    = r.global.getResource<ScreenWidth>()->get();
+    const auto sh    = r.global.getResource<ScreenHeight>()->get();
+    auto      &round = r.level.getResource<Round>()->get();
 
-  // No player scored yet
-  if (!be) {
-    return;
-  }
+    auto [_, ballPos, ballVel] = *ball;
 
-  for (auto &[pp, p, ps] : iter) {
-    if (be->scoringPlayer == *p) {
-      ps->incrementScore();
-    }
+    ballPos.x = sw / 2;
+    ballPos.y = sh / 2;
+    round += 1;
 
-    if (ps->score == maxGoals) {
+    // Flip the ball's direction every round
+    if (round % 2 == 0) {
+      ballVel = {ballSpeed, 0};
+    } else {
+      ballVel = {-ballSpeed, 0};
+    }
 
-      switch (*p) {
-      case Player::Human:
-        r.global.addResource(GameResult::Won);
-        break;
-      case Player::AI:
-        r.global.addResource(GameResult::Lost);
-        break;
+    for (auto [pp, p, ps] : iter) {
+      if (goal.scoringPlayer == p) {
+        ps.incrementScore();
       }
 
-      r.global.addResource(ecs::TransitionToScene(pong::sceneNames::gameOver));
+      if (ps.score == maxGoals) {
+
+        switch (p) {
+        case Player::Human:
+          r.global.addResource(GameResult::Won);
+          break;
+        case Player::AI:
+          r.global.addResource(GameResult::Lost);
+          break;
+        }
+
+        r.global.addResource(ecs::TransitionToScene(pong::sceneNames::gameOver));
+      }
     }
   }
 }
@@ -322,13 +339,13 @@ void playerCollisions(
 ) {
   for (const auto &[rect, playerPosition, player] : players) {
     const auto playerRect =
-        Rectangle{playerPosition->x, playerPosition->y, static_cast<f32>(rect->width), static_cast<f32>(rect->height)};
+        Rectangle{playerPosition.x, playerPosition.y, static_cast<f32>(rect.width), static_cast<f32>(rect.height)};
 
     const auto hit = CheckCollisionCircleRec(ballPosition, circle.radius, playerRect);
 
     if (hit) {
-      resolveBallCollision(ballPosition, ballVelocity, circle, *playerPosition);
-      onBallHit(ballPosition, ballVelocity, *playerPosition, *rect);
+      resolveBallCollision(ballPosition, ballVelocity, circle, playerPosition);
+      onBallHit(ballPosition, ballVelocity, playerPosition, rect);
       break;
     }
   }
@@ -346,40 +363,42 @@ void wallCollisions(Pos2D &ballPosition, Velocity &ballVelocity, Circle &circle,
 }
 
 void checkCollisions(
-    ecs::ResourceBundle                         r,
+    ecs::Res<DeltaTime>                         deltaTime,
+    ecs::Res<ScreenHeight>                      screenHeight,
     ecs::ComponentIter<Circle, Pos2D, Velocity> balls,
     ecs::ComponentIter<Rect, Pos2D, Player>     players
 ) {
-  const auto dt = r.global.getResource<DeltaTime>()->get();
-  const auto sh = r.global.getResource<ScreenHeight>()->get();
+  const auto dt = *deltaTime;
+  const auto sh = *screenHeight;
 
   // Note: The Y axis for raylib is top-bottom, the x axis is left-right
   for (const auto &[circle, ballPosition, ballVelocity] : balls) {
-    playerCollisions(players, *ballPosition, *ballVelocity, *circle);
-    wallCollisions(*ballPosition, *ballVelocity, *circle, dt, sh);
+    playerCollisions(players, ballPosition, ballVelocity, circle);
+    wallCollisions(ballPosition, ballVelocity, circle, dt, sh);
   }
 }
 
 void resetGame(
-    ecs::ResourceBundle                                      r,
+    ecs::Res<ScreenWidth>                                    screenWidth,
+    ecs::Res<ScreenHeight>                                   screenHeight,
     ecs::ComponentIter<Player, Pos2D, PlayerScore, Velocity> players,
-    ecs::ComponentIter<Circle, Pos2D, Velocity>              ball
+    ecs::Single<Circle, Pos2D, Velocity>                     ball
 ) {
-  const f32 sw = r.global.getResource<ScreenWidth>()->get();
-  const f32 sh = r.global.getResource<ScreenHeight>()->get();
+  const f32 sw = *screenWidth;
+  const f32 sh = *screenHeight;
 
-  for (auto &[player, playerPos, playerScore, playerVel] : players) {
-    playerPos->y = (sh - paddleHeight) / 2.f;
-    *playerVel   = {0, 0};
+  for (auto [player, playerPos, playerScore, playerVel] : players) {
+    playerPos.y = (sh - paddleHeight) / 2.f;
+    playerVel   = {0, 0};
 
-    playerScore->score = 0;
-    playerScore->updateText();
+    playerScore.score = 0;
+    playerScore.updateText();
   }
 
-  auto [_, ballPos, ballVel] = *ball.begin();
+  auto [_, ballPos, ballVel] = *ball;
 
-  *ballPos = {sw / 2.0f, sh / 2.0f};
-  *ballVel = Velocity{ballSpeed, 0};
+  ballPos = {sw / 2.0f, sh / 2.0f};
+  ballVel = Velocity{ballSpeed, 0};
 }
 
 void setupMainGame(ecs::Resources &global, ecs::Level &mg) {
@@ -429,6 +448,8 @@ void setupMainGame(ecs::Resources &global, ecs::Level &mg) {
     mg.addResource(Paused{false});
     mg.addResource(Round{0});
 
+    mg.addEvents<PlayerScored>();
+
     // Note the extra curly brace pair since we're wrapping a MenuScreen struct
     mg.addResource(PauseScreen{{
         .x = static_cast<u32>(sw / 2.),
@@ -460,32 +481,49 @@ void setupMainGame(ecs::Resources &global, ecs::Level &mg) {
 
   // Per frame systems
   {
-    mg.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Player, Pos2D, Velocity>, ecs::Query<Circle, Pos2D>>(
-        handleInputs
-    );
+    mg.addPerFrameSystem<
+        ecs::Res<Input>,
+        ecs::Res<ScreenWidth>,
+        ecs::Res<Time>,
+        ecs::Option<ecs::Res<AIDifficulty>>,
+        ecs::ResMut<Paused>,
+        ecs::Query<Player, Pos2D, Velocity>,
+        ecs::Single<Circle, Pos2D>>(handleInputs);
+
+    mg.addPerFrameSystem<ecs::Res<Paused>, ecs::Res<DeltaTime>, ecs::Query<Pos2D, Velocity>>(moveObjects);
+    mg.addPerFrameSystem<
+        ecs::Res<DeltaTime>,
+        ecs::Res<ScreenHeight>,
+        ecs::Query<Circle, Pos2D, Velocity>,
+        ecs::Query<Rect, Pos2D, Player>>(checkCollisions);
 
-    mg.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Pos2D, Velocity>>(moveObjects);
-    mg.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Circle, Pos2D, Velocity>, ecs::Query<Rect, Pos2D, Player>>(
-        checkCollisions
-    );
+    // Stuff that involves rendering. Only reads components, so it runs next to `checkGoal`.
+    mg.addPerFrameSystem<
+        ecs::ResMut<Renderer>,
+        ecs::Query<const Pos2D, const Rect, const Color>,
+        ecs::Query<const Pos2D, const Circle, const Color>,
+        ecs::Query<const PlayerScore>>(render);
 
-    // Stuff that involves rendering
     mg.addPerFrameSystem<
-        ecs::ResourceBundle,
-        ecs::Query<Pos2D, Rect, Color>,
-        ecs::Query<Pos2D, Circle, Color>,
-        ecs::Query<PlayerScore>>(render);
+        ecs::Res<ScreenWidth>,
+        ecs::ResMut<ecs::Events<PlayerScored>>,
+        ecs::Query<const Circle, const Pos2D>>(checkGoal);
 
-    mg.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Circle, Pos2D, Velocity>>(checkGoal);
-    mg.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Pos2D, Player, PlayerScore>>(onGoal);
+    mg.addPerFrameSystem<ecs::ResourceBundle>(updatePauseMenu);
+    mg.addPerFrameSystem<
+        ecs::ResourceBundle,
+        ecs::EventReader<PlayerScored>,
+        ecs::Query<Pos2D, Player, PlayerScore>,
+        ecs::Single<const Circle, Pos2D, Velocity>>(onGoal);
   }
 
   // Reset system
   {
     mg.addResetSystem<
-        ecs::ResourceBundle,
+        ecs::Res<ScreenWidth>,
+        ecs::Res<ScreenHeight>,
         ecs::Query<Player, Pos2D, PlayerScore, Velocity>,
-        ecs::Query<Circle, Pos2D, Velocity>>(resetGame);
+        ecs::Single<Circle, Pos2D, Velocity>>(resetGame);
   }
 }
 }; // namespace pong
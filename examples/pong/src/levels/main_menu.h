@@ -152,7 +152,7 @@ void setupMainMenu(ecs::Resources &global, ecs::Level &mm) {
   });
 
   // Stuff that involves rendering
-  mm.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Text, TextAnimation, CenterText>>(renderMenuTitle);
+  mm.addPerFrameSystem<ecs::ResourceBundle, ecs::Query<Text, TextAnimation, ecs::With<CenterText>>>(renderMenuTitle);
   mm.addPerFrameSystem<ecs::ResourceBundle>(ScreenManager::update);
 
   mm.addResetSystem<ecs::ResourceBundle>(ScreenManager::reset);